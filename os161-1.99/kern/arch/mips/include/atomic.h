@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations for MIPS, using LL/SC. See <atomic.h> for the
+ * interface. Each read-modify-write retries until its SC succeeds.
+ *
+ * The read-modify-write operations don't imply any memory ordering;
+ * use the membar_* functions for that. They are all SYNC, which on
+ * MIPS32 orders everything before it against everything after it.
+ */
+
+void membar_any_any(void);
+void membar_load_load(void);
+void membar_store_store(void);
+void membar_load_any(void);
+void membar_store_any(void);
+
+uint32_t atomic_fetchadd(volatile uint32_t *p, uint32_t val);
+uint32_t atomic_cas(volatile uint32_t *p, uint32_t old, uint32_t new);
+uint32_t atomic_swap(volatile uint32_t *p, uint32_t new);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+void
+membar_any_any(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+ATOMIC_INLINE
+void
+membar_load_load(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_store_store(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_load_any(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_store_any(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_fetchadd(volatile uint32_t *p, uint32_t val)
+{
+	uint32_t x, y;
+
+	/*
+	 * Load the existing value into X and store X+VAL from Y.
+	 * After the SC, Y contains 1 if the store succeeded, 0 if
+	 * it failed.
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + val */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (val)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_cas(volatile uint32_t *p, uint32_t old, uint32_t new)
+{
+	uint32_t x, y;
+
+	/*
+	 * As above, but give up without storing if X isn't OLD. Y is
+	 * zeroed in the branch delay slot so that case leaves the
+	 * loop through the X != OLD test, not the SC one.
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set noreorder;"	/* we fill the delay slot */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != old) give up */
+			" move %1, $0;"		/*   (delay slot) y = 0 */
+			"move %1, %4;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1: .set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+		if (x != old) {
+			return x;
+		}
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_swap(volatile uint32_t *p, uint32_t new)
+{
+	uint32_t x, y;
+
+	do {
+		y = new;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
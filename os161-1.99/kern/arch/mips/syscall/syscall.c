@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <percpu.h>
 #include "opt-A2.h"
 #include <limits.h>
 
@@ -76,6 +77,8 @@
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
  */
+struct pcpu_counter syscall_count = PCPU_COUNTER_INITIALIZER;
+
 void syscall(struct trapframe *tf) {
 	int callno;
 	int32_t retval;
@@ -86,6 +89,7 @@ void syscall(struct trapframe *tf) {
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	pcpu_counter_inc(&syscall_count);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -107,6 +111,35 @@ void syscall(struct trapframe *tf) {
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_sched_getstats:
+		err = sys_sched_getstats((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_sched_setaffinity:
+		err = sys_sched_setaffinity((pid_t)tf->tf_a0,
+					    (uint32_t)tf->tf_a1);
+		break;
+
+	    case SYS_sched_getaffinity:
+		err = sys_sched_getaffinity((pid_t)tf->tf_a0,
+					    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0,
+				     (int32_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0,
+				     (int)tf->tf_a1, &retval);
+		break;
 #ifdef UW
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
@@ -136,6 +169,13 @@ void syscall(struct trapframe *tf) {
 	case SYS_execv:
 		err = sys_execv((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 		break;
+	case SYS_vfork:
+		err = sys_vfork(tf, (pid_t*)&retval);
+		break;
+	case SYS_spawn:
+		err = sys_spawn((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+				(pid_t*)&retval);
+		break;
 #endif
 
 	    /* Add stuff here */
@@ -71,7 +71,9 @@ static CoreMap cm = {0, NULL, 0, false};
 #endif
 
 void vm_bootstrap(void) {
+	spinlock_register(&stealmem_lock, "stealmem");
 	#if OPT_A3
+	spinlock_register(&coremapLock, "coremap");
 	paddr_t lo;
 	paddr_t hi;
 	ram_getsize(&lo, &hi);
@@ -566,6 +568,56 @@ int as_define_stack(struct addrspace *as, vaddr_t *stackptr) {
 	return 0;
 }
 
+int as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret) {
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	vaddr_t page = vaddr & PAGE_FRAME;
+	paddr_t paddr;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	#if OPT_A3
+		if (as->as_pbase1 == NULL) {
+			return EFAULT;
+		}
+		if (page >= vbase1 && page < vtop1) {
+			paddr = as->as_pbase1[(page - vbase1) / PAGE_SIZE];
+		}
+		else if (page >= vbase2 && page < vtop2) {
+			paddr = as->as_pbase2[(page - vbase2) / PAGE_SIZE];
+		}
+		else if (page >= stackbase && page < stacktop) {
+			paddr = as->as_stackpbase[(page - stackbase) / PAGE_SIZE];
+		}
+		else {
+			return EFAULT;
+		}
+	#else
+		if (as->as_pbase1 == 0) {
+			return EFAULT;
+		}
+		if (page >= vbase1 && page < vtop1) {
+			paddr = (page - vbase1) + as->as_pbase1;
+		}
+		else if (page >= vbase2 && page < vtop2) {
+			paddr = (page - vbase2) + as->as_pbase2;
+		}
+		else if (page >= stackbase && page < stacktop) {
+			paddr = (page - stackbase) + as->as_stackpbase;
+		}
+		else {
+			return EFAULT;
+		}
+	#endif
+
+	*ret = paddr | (vaddr & ~PAGE_FRAME);
+	return 0;
+}
+
 int as_copy(struct addrspace *old, struct addrspace **ret) {
 	struct addrspace *new;
 	//kprintf("called as_copy\n");
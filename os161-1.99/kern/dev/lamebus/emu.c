@@ -45,6 +45,7 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
+#include <atomic.h>
 #include <array.h>
 #include <uio.h>
 #include <synch.h>
@@ -480,6 +481,8 @@ emufs_reclaim(struct vnode *v)
 	lock_acquire(ef->ef_emu->e_lock);
 
 	if (ev->ev_v.vn_refcount != 1) {
+		/* consume the reference VOP_DECREF gave us */
+		atomic_dec(&ev->ev_v.vn_refcount);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on 32-bit words of memory, for counters and flags
+ * that would otherwise need a lock around each update.
+ *
+ *    atomic_fetchadd - add VAL to *P; returns the old value.
+ *    atomic_add      - add VAL to *P; returns the new value.
+ *    atomic_inc      - add one; returns the new value.
+ *    atomic_dec      - subtract one; returns the new value.
+ *    atomic_cas      - if *P is OLD, store NEW. Returns what was in
+ *                      *P, which is OLD exactly when the store was done.
+ *    atomic_swap     - store NEW; returns the old value.
+ *
+ * Plain aligned loads and stores of a volatile word are already
+ * atomic. None of the above orders other memory accesses; for that
+ * there are memory barriers:
+ *
+ *    membar_any_any     - all accesses before vs. all accesses after.
+ *    membar_load_load   - loads before vs. loads after.
+ *    membar_store_store - stores before vs. stores after.
+ *    membar_load_any    - loads before vs. all accesses after (for
+ *                         taking a reference or a lock).
+ *    membar_store_any   - stores before vs. all accesses after.
+ *
+ * Signed counters can be used with casts; the arithmetic is the same.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+uint32_t atomic_add(volatile uint32_t *p, uint32_t val);
+uint32_t atomic_inc(volatile uint32_t *p);
+uint32_t atomic_dec(volatile uint32_t *p);
+
+ATOMIC_INLINE
+uint32_t
+atomic_add(volatile uint32_t *p, uint32_t val)
+{
+	return atomic_fetchadd(p, val) + val;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_inc(volatile uint32_t *p)
+{
+	return atomic_add(p, 1);
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_dec(volatile uint32_t *p)
+{
+	return atomic_add(p, (uint32_t)-1);
+}
+
+#endif /* _ATOMIC_H_ */
@@ -38,10 +38,12 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU every LT_GRANULARITY usec and
+ * runs the timing wheel behind clocksleep/clocknap/clocknanosleep.
  *
  * gettime() may be used to fetch the current time of day.
+ * gettime_nsecs() returns the same as a single nanosecond count, or 0
+ * if no clock is attached yet; it is meant for measuring intervals.
  * getinterval() computes the time from time1 to time2.
  *
  * XXX we have struct timespec now, let's use it.
@@ -62,6 +64,7 @@ void hardclock(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+uint64_t gettime_nsecs(void);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -71,7 +74,6 @@ void getinterval(time_t secs1, uint32_t nsecs,
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
  *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
@@ -83,5 +85,11 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * clocknanosleep() suspends execution for at least the given time,
+ * rounded up to whole timer ticks.
+ */
+void clocknanosleep(time_t secs, uint32_t nsecs);
+
 
 #endif /* _CLOCK_H_ */
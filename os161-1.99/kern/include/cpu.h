@@ -36,6 +36,12 @@
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of priority levels in each cpu's run queue. Level 0 is the
+ * highest priority; see schedule() in thread.c.
+ */
+#define RUNQUEUE_LEVELS 4
+
 /*
  * Per-cpu structure
  *
@@ -59,14 +65,21 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Reusable thread structs/stacks */
+	struct thread *c_migrating;	/* Thread to requeue after switch */
+	struct thread *c_idlethread;	/* Runs when nothing else can */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	uint64_t c_busytime;		/* Time spent running threads (ns) */
+	uint64_t c_idletime;		/* Time spent in cpu_idle (ns) */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_resched;			/* Higher-priority thread waiting */
+	struct threadlist c_runqueue[RUNQUEUE_LEVELS]; /* Run queues */
+	unsigned c_runcount;		/* Total threads on the run queues */
 	struct spinlock c_runqueue_lock;
 
 	/*
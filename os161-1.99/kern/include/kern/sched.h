@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2004, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SCHED_H_
+#define _KERN_SCHED_H_
+
+/*
+ * Definitions for scheduler statistics and control.
+ */
+
+/*
+ * Load averages are fixed point, with LOADAVG_SCALE representing 1.0.
+ */
+#define LOADAVG_SHIFT	11
+#define LOADAVG_SCALE	(1 << LOADAVG_SHIFT)
+
+/*
+ * Per-thread scheduling statistics, as returned by sched_getstats().
+ * Times are in nanoseconds.
+ */
+struct schedstats {
+	__u64 ss_runtime;		/* time spent running */
+	__u64 ss_waittime;		/* time spent runnable, waiting for a cpu */
+	__u64 ss_sleeptime;		/* time spent blocked */
+	__u32 ss_nvcsw;			/* voluntary context switches (count) */
+	__u32 ss_nivcsw;		/* involuntary ditto (count) */
+	__u32 ss_loadavg[3];		/* system 1, 5, 15 minute load averages */
+};
+
+#endif /* _KERN_SCHED_H_ */
@@ -197,6 +197,18 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling --
+#define SYS_sched_getstats 121
+#define SYS_sched_setaffinity 122
+#define SYS_sched_getaffinity 123
+
+//                              -- Synchronization --
+#define SYS_futex_wait   124
+#define SYS_futex_wake   125
+
+//                              -- Process creation --
+#define SYS_spawn        126
+
 /*CALLEND*/
 
 
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics, and the lockstat profiler.
+ *
+ * Every sleep lock keeps a struct lockstats. In kernels built with
+ * "options lockstat", CVs and selected spinlocks keep one too, locks
+ * also measure how long they're held, and all of them are entered in
+ * a registry so the "lockstat" menu command can report on them,
+ * summed by name. Otherwise none of the profiler exists and the
+ * registration calls below are compiled out.
+ */
+
+#include "opt-lockstat.h"
+
+/*
+ * Statistics. Waiting time is only measured on acquires that found
+ * the lock held, so uncontended acquires don't pay for reading the
+ * clock. For a CV, an "acquire" is a wait and the waiting time is
+ * the time until the lock was reacquired; for a spinlock, nothing is
+ * timed but the spin iterations are counted.
+ */
+struct lockstats {
+	unsigned ls_acquires;		/* Total acquires */
+	unsigned ls_contended;		/* Acquires that found it held */
+	unsigned ls_spun;		/* ...and got it without sleeping */
+	unsigned ls_slept;		/* Times a thread slept on it */
+	uint64_t ls_waitns;		/* Time spent in contended acquires */
+	uint64_t ls_maxwaitns;		/* Longest of those */
+	uint64_t ls_holdns;		/* Time held (lockstat only) */
+	uint64_t ls_maxholdns;		/* Longest hold (lockstat only) */
+	uint64_t ls_spins;		/* Iterations spent spinning */
+};
+
+#define LOCKSTATS_INITIALIZER	{ 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+#if OPT_LOCKSTAT
+
+/* Kinds of lock, for the registry. */
+#define LOCKSTAT_LOCK	0
+#define LOCKSTAT_CV	1
+#define LOCKSTAT_SPIN	2
+
+/*
+ * Registry entry. Embedded in each registered object; LSE_OBJ points
+ * back at the object and LSE_NAME at its name, which must stay valid
+ * until the object is unregistered.
+ */
+struct lockstat_entry {
+	struct lockstat_entry *lse_prev;
+	struct lockstat_entry *lse_next;
+	unsigned lse_kind;
+	const char *lse_name;
+	void *lse_obj;
+};
+
+#define LOCKSTAT_ENTRY_INITIALIZER	{ NULL, NULL, 0, NULL, NULL }
+
+/*
+ * Functions:
+ *    lockstat_register   - Add an object to the registry.
+ *    lockstat_unregister - Take it out again, when it is destroyed.
+ *                          FINAL is its last statistics, which are kept
+ *                          and still reported under its name.
+ *    lockstat_report     - Print the contention report, most contended
+ *                          first.
+ *    lockstat_reset      - Zero all the statistics.
+ */
+void lockstat_register(struct lockstat_entry *lse, unsigned kind,
+		       const char *name, void *obj);
+void lockstat_unregister(struct lockstat_entry *lse,
+			 const struct lockstats *final);
+void lockstat_report(void);
+void lockstat_reset(void);
+
+#else
+
+#define lockstat_register(lse, kind, name, obj)
+#define lockstat_unregister(lse, final)
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+/*
+ * Per-cpu variables and counters.
+ *
+ * A per-cpu variable is an array with one slot for each possible
+ * cpu, each slot padded out to its own cache line so that one cpu
+ * updating its slot doesn't steal the line out from under another.
+ *
+ *    PERCPU_DEFINE(type, name) - define (or, with "static" in front,
+ *                                privately define) a per-cpu variable.
+ *    PERCPU_CPU(name, n)       - cpu N's copy, as an lvalue.
+ *    PERCPU_THIS(name)         - the current cpu's copy, as an lvalue.
+ *
+ * PERCPU_THIS is only meaningful while the thread can't switch cpus:
+ * with interrupts off, or while holding a spinlock. It works before
+ * curcpu is set up during boot, when everything runs as cpu 0.
+ *
+ * A per-cpu counter is a 32-bit count with a slot on every cpu. It
+ * is incremented locally, without any atomic operation or lock and
+ * without touching other cpus' cache lines, and read by adding up all
+ * the slots. Reads are therefore not a snapshot: increments running
+ * concurrently on other cpus may or may not be included.
+ *
+ *    pcpu_counter_add     - add N on the current cpu.
+ *    pcpu_counter_inc     - add one on the current cpu.
+ *    pcpu_counter_read    - total over all cpus.
+ *    pcpu_counter_readcpu - cpu N's part of the total.
+ *    pcpu_counter_zero    - clear all cpus' slots. Increments that
+ *                           happen at the same time may be lost.
+ *
+ * Counters need no setup beyond PCPU_COUNTER_INITIALIZER (or zeroed
+ * memory); each one is assigned its storage the first time it's used.
+ * There is room for PCPU_COUNTERS of them in the whole system and the
+ * storage isn't given back, so counters should be static or global,
+ * not parts of objects that come and go.
+ */
+
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <machine/vm.h>
+
+#define PERCPU_DEFINE(type, name) \
+	struct percpu_##name { \
+		type pcv_val; \
+	} __attribute__((__aligned__(CACHELINE_SIZE))) name[MAXCPUS]
+
+#define PERCPU_CPU(name, n)	((name)[(n)].pcv_val)
+#define PERCPU_THIS(name)	PERCPU_CPU(name, percpu_curnum())
+
+/* Number of the current cpu; cpu 0 during early boot. */
+#define percpu_curnum()		(CURCPU_EXISTS() ? curcpu->c_number : 0)
+
+/* Per-cpu counters. */
+#define PCPU_COUNTERS	32
+
+struct pcpu_counter {
+	volatile unsigned pc_slot;	/* Index into per-cpu storage, or 0 */
+};
+
+#define PCPU_COUNTER_INITIALIZER	{ 0 }
+
+void pcpu_counter_add(struct pcpu_counter *pc, uint32_t n);
+void pcpu_counter_inc(struct pcpu_counter *pc);
+uint32_t pcpu_counter_read(struct pcpu_counter *pc);
+uint32_t pcpu_counter_readcpu(struct pcpu_counter *pc, unsigned cpunum);
+void pcpu_counter_zero(struct pcpu_counter *pc);
+
+
+#endif /* _PERCPU_H_ */
@@ -38,6 +38,7 @@
 
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <wchan.h>
 #include "opt-A2.h"
 #include <limits.h>
 
@@ -54,22 +55,63 @@ struct semaphore;
 
 #if OPT_A2
 
-// process lock
-struct lock* procLock;
-
 // wrap the process with additional information
-// including its parent PID, exit code and a condition variable
+// including its parent PID, exit code and a wait channel.
+// An entry is in use from fork until the process has exited and been
+// reaped: by its parent's waitpid, or at once if it has no parent.
+// Until then proc is NULL after exit and exitCode is valid.
+//
+// Exited children also go on their parent's exited list, in the order
+// they exited, so waitpid(-1) can reap them in completion order.
+//
+// Locking is per entry, so unrelated processes don't contend:
+// entryLock protects the entry's own fields and its lists of children.
+// The fields of an entry with a parent (parentPID, proc, exitCode,
+// inUse) only change with both the parent's entryLock and its own
+// held, so holding either is enough to read them. The list links
+// (nextSibling, nextExited) belong to the parent's lists and are
+// protected by the parent's lock. Take a parent's lock before its
+// child's.
 typedef struct procWrapper {
+	struct spinlock entryLock;
 	struct proc* proc;
-	pid_t parentPID;
+	pid_t parentPID;	// -1 for none, or if the parent has exited
 	int exitCode;
-	struct cv* procCV;
+	bool inUse;		// PID is allocated
+	pid_t firstChild;	// children not yet reaped, linked by
+	pid_t nextSibling;	//   nextSibling; -1 ends the list
+	pid_t firstExited;	// exited children, oldest first, linked
+	pid_t lastExited;	//   by nextExited
+	pid_t nextExited;
+	pid_t nextFree;		// free list link while !inUse
+	struct wchan childWchan; // waitpid sleeps here for a child to exit
 } procWrapper;
 
-// array used to store all process wrappers, no more than 64 processes
-// storing proc using index representing PID 
-// if pid is 5, then store proc at index 5 
-procWrapper allProcess[128];
+// The process table is indexed by PID and grows in chunks of
+// PROC_CHUNK entries as needed, up to PID_MAX. Chunks never move once
+// allocated, so an entry pointer stays good for as long as the entry
+// is in use. Freed PIDs are reused oldest first.
+#define PROC_CHUNK 128
+
+// Find the entry for a running process PID and return it with its
+// entryLock held, which keeps the process from exiting; or NULL.
+// Release with procUnlock.
+procWrapper* procLookup(pid_t pid);
+void procUnlock(pid_t pid);
+
+// Make CHILD, freshly created, a child of PARENT.
+void procAddChild(struct proc* parent, struct proc* child);
+
+// Record that P has exited with EXITCODE: orphan its children, and
+// wake its parent or, if it has none, release its PID.
+void procExit(struct proc* p, int exitcode);
+
+// Wait for the current process's child PID, or for any child if PID
+// is -1, to exit; reap it, and hand back its PID and exit code. With
+// NOHANG, hand back PID 0 instead of waiting if none has exited yet.
+// Fails with ESRCH if PID isn't a child, or ECHILD if PID is -1 and
+// there are no children.
+int procWait(pid_t pid, bool nohang, pid_t* retpid, int* exitcode);
 
 #endif
 
@@ -77,6 +119,9 @@ struct proc {
 
 	#if OPT_A2 
 		pid_t procPID;
+		// set while a vfork child borrows its parent's address
+		// space; the parent sleeps on it until exec or exit
+		struct semaphore* p_vforkSem;
 	#endif
 
 	char *p_name;			/* Name of this process */
@@ -130,5 +175,8 @@ struct addrspace *curproc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
+/* Print scheduling statistics for every thread of every process. */
+void proc_printstats(void);
+
 
 #endif /* _PROC_H_ */
@@ -21,6 +21,9 @@
  *       q_len     - returns the number of elements in the queue
  *                   (q_getsize is the maximum number of elements that
  *                    can be in the queue)
+ *
+ * The queue does no locking of its own. For a fixed-size queue that
+ * can be shared without a lock, see ring.h.
  */
 
 struct queue; /* Opaque. */
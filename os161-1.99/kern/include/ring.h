@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _RING_H_
+#define _RING_H_
+
+/*
+ * Fixed-size lock-free ring buffers of (non-NULL) void pointers.
+ *
+ * Unlike struct queue (queue.h) these never grow and never need a
+ * lock: producers and consumers coordinate through the ring indexes
+ * alone, so they can be used from interrupt handlers and across cpus
+ * without a spinlock. The size is rounded up to a power of two.
+ *
+ * struct spscring allows one producer and one consumer at a time
+ * (each may be a different thread or cpu, or an interrupt handler).
+ * It needs no atomic operations, only memory barriers.
+ *
+ * struct mpmcring allows any number of producers and consumers. Each
+ * slot carries a sequence number saying which trip around the ring
+ * it's ready for; a producer or consumer claims a position with
+ * atomic_cas on the shared index and then hands the slot over by
+ * advancing its sequence number.
+ *
+ * Functions (for both, with prefix spscring_ or mpmcring_):
+ *      create      - allocate a ring holding at least SIZE pointers.
+ *                    Returns NULL on error.
+ *      destroy     - dispose of the ring, which must be empty.
+ *      enqueue     - add PTR. Returns ENOSPC if the ring is full.
+ *      dequeue     - remove the oldest pointer and return it, or NULL
+ *                    if the ring is empty.
+ *      enqueue_batch - add up to N pointers from PTRS, in order.
+ *                    Returns how many were added, which is fewer
+ *                    than N only if the ring filled up.
+ *      dequeue_batch - remove up to MAX pointers into PTRS. Returns
+ *                    how many were removed.
+ *      empty       - true if the ring is empty. Only a hint if other
+ *                    threads are using the ring at the same time.
+ *
+ * A batch operation on an mpmcring claims all its slots with one
+ * atomic_cas, so the items of one batch stay together in the ring.
+ */
+
+#include <machine/vm.h>		/* for CACHELINE_SIZE */
+
+/*
+ * The producer's and consumer's indexes each get a cache line, so
+ * the two sides don't slow each other down by sharing one.
+ */
+
+struct spscring {
+	volatile uint32_t sr_head;	/* Next position to dequeue */
+	char sr_pad1[CACHELINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t sr_tail;	/* Next position to enqueue */
+	char sr_pad2[CACHELINE_SIZE - sizeof(uint32_t)];
+	unsigned sr_mask;		/* Size - 1 */
+	void *volatile *sr_slots;
+};
+
+struct mpmcring_slot {
+	volatile uint32_t ms_seq;	/* Position this slot is ready for */
+	void *volatile ms_ptr;
+};
+
+struct mpmcring {
+	volatile uint32_t mr_head;	/* Next position to dequeue */
+	char mr_pad1[CACHELINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t mr_tail;	/* Next position to enqueue */
+	char mr_pad2[CACHELINE_SIZE - sizeof(uint32_t)];
+	unsigned mr_mask;		/* Size - 1 */
+	struct mpmcring_slot *mr_slots;
+};
+
+struct spscring *spscring_create(unsigned size);
+void spscring_destroy(struct spscring *r);
+int spscring_enqueue(struct spscring *r, void *ptr);
+void *spscring_dequeue(struct spscring *r);
+unsigned spscring_enqueue_batch(struct spscring *r, void **ptrs, unsigned n);
+unsigned spscring_dequeue_batch(struct spscring *r, void **ptrs, unsigned max);
+bool spscring_empty(struct spscring *r);
+
+struct mpmcring *mpmcring_create(unsigned size);
+void mpmcring_destroy(struct mpmcring *r);
+int mpmcring_enqueue(struct mpmcring *r, void *ptr);
+void *mpmcring_dequeue(struct mpmcring *r);
+unsigned mpmcring_enqueue_batch(struct mpmcring *r, void **ptrs, unsigned n);
+unsigned mpmcring_dequeue_batch(struct mpmcring *r, void **ptrs, unsigned max);
+bool mpmcring_empty(struct mpmcring *r);
+
+
+#endif /* _RING_H_ */
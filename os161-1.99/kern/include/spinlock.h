@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include <lockstat.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -53,16 +54,34 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * These are ticket locks: an acquirer takes the next number from
+ * lk_next and waits until lk_serving reaches it. CPUs get the lock in
+ * the order they asked for it, so nobody starves, and a release only
+ * disturbs the waiters by changing lk_serving once.
  */
 struct spinlock {
-	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket holding the lock. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstats lk_stats;	/* Protected by the lock itself. */
+	struct lockstat_entry lk_stat;	/* If registered. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTATS_INITIALIZER, \
+				  LOCKSTAT_ENTRY_INITIALIZER }
+#else
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -74,6 +93,12 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * register	Report the lock under NAME in the lockstat profile. Does
+ *		nothing unless lockstat is compiled in. NAME is not
+ *		copied, and a registered lock must never be cleaned up.
+ * getstats	Copy out the lock's statistics (all zero without
+ *		lockstat). The copy is not taken atomically.
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -84,5 +109,8 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+void spinlock_register(struct spinlock *lk, const char *name);
+void spinlock_getstats(struct spinlock *lk, struct lockstats *ls);
+
 
 #endif /* _SPINLOCK_H_ */
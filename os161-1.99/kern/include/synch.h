@@ -36,6 +36,8 @@
 
 
 #include <spinlock.h>
+#include <wchan.h>
+#include <lockstat.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -45,7 +47,7 @@
  */
 struct semaphore {
         char *sem_name;
-	struct wchan *sem_wchan;
+	struct wchan sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
 };
@@ -71,15 +73,33 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins while
+ * the owner is running on another cpu, since it will probably let go
+ * soon and that's much cheaper than sleeping and being woken. It
+ * sleeps if the owner is not running or the spin budget runs out.
+ *
+ * A thread that sleeps on a lock lends its priority to the owner
+ * until the owner releases it (see thread_level), and on down the
+ * chain if the owner is itself asleep on another lock.
  */
 struct lock {
         char* lk_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
 	volatile bool held;
-	struct thread* owner;
-	struct wchan* wc;
+	struct thread* volatile owner;
+	struct cpu* volatile ownercpu;	// cpu owner acquired it on
+	struct wchan wc;			// turnstile channel
 	struct spinlock spin;
+	unsigned nwaiters;		// threads asleep on wc, or about to be
+	struct lock* heldnext;		// next in the owner's t_heldlocks
+#if OPT_LOCKSTAT
+	// contention statistics, protected by spin; see lock_getstats
+	struct lockstats stats;
+	uint64_t acquiredns;		// when the owner got it
+	struct lockstat_entry lk_stat;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -100,6 +120,15 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * Statistics (see lockstat.h):
+ *    lock_getstats   - Copy out the lock's contention statistics
+ *                      (all zero without lockstat).
+ *    lock_printstats - Print them.
+ */
+void lock_getstats(struct lock *, struct lockstats *);
+void lock_printstats(struct lock *);
+
 
 /*
  * Condition variable.
@@ -119,7 +148,12 @@ struct cv {
         char *cv_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
-	struct wchan* wc;
+	struct wchan wc;
+#if OPT_LOCKSTAT
+	// wait statistics, protected by the lock used with the cv
+	struct lockstats cv_stats;
+	struct lockstat_entry cv_stat;
+#endif
 };
 
 struct cv *cv_create(const char *name);
@@ -130,7 +164,9 @@ void cv_destroy(struct cv *);
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
- *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_broadcast - Wake up all threads sleeping on this CV. Only one
+ *                   is actually woken; the rest are moved to sleep on
+ *                   the lock and woken one per lock_release.
  *
  * For all three operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
@@ -142,5 +178,56 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+#if OPT_LOCKSTAT
+/* Copy out the cv's wait statistics. Not taken atomically. */
+void cv_getstats(struct cv *cv, struct lockstats *ls);
+#endif
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * The lock prefers writers: once a writer is waiting, new readers
+ * block until it has been through, so a steady stream of readers
+ * can't starve it out. Neither side may acquire the lock
+ * recursively; in particular a reader that tries to read-lock again
+ * while a writer is waiting will deadlock.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+	char *rw_name;
+	struct spinlock rw_spin;
+	struct wchan rw_readwc;			// readers waiting
+	struct wchan rw_writewc;		// writers waiting
+	volatile unsigned rw_readers;		// readers holding it
+	volatile unsigned rw_waitwriters;	// writers waiting
+	struct thread* volatile rw_writer;	// writer holding it
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared, along with any other
+ *                           readers. Blocks while a writer holds or is
+ *                           waiting for the lock.
+ *    rwlock_release_read  - Give up a shared hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Give up an exclusive hold.
+ *    rwlock_do_i_hold     - Return true if the current thread holds the
+ *                           lock for writing. (Readers aren't tracked
+ *                           individually, so there's no way to ask
+ *                           about a shared hold.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
@@ -39,6 +39,9 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/* Number of system calls made; a per-cpu counter (see <percpu.h>). */
+extern struct pcpu_counter syscall_count;
+
 /*
  * Support functions.
  */
@@ -51,15 +54,28 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
 
+/*
+ * Set up the futex wait queues.
+ */
+void futex_bootstrap(void);
+
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
  */
  
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys_sched_getstats(userptr_t user_stats);
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t user_mask);
+int sys_futex_wait(userptr_t uaddr, int32_t val);
+int sys_futex_wake(userptr_t uaddr, int count, int32_t *retval);
 
 #ifdef UW
 pid_t sys_fork(struct trapframe* tf, pid_t* retval);
+pid_t sys_vfork(struct trapframe* tf, pid_t* retval);
+int sys_spawn(const_userptr_t program, userptr_t argv, pid_t* retval);
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
@@ -48,6 +48,11 @@ int traffic_simulation(int, char **);
  * Test code.
  */
 
+/* helpers for checking results (testutil.c); return 1 on failure */
+int testcheck(const char *test, const char *what, bool ok);
+int testcheckval(const char *test, const char *what,
+		 uint32_t got, uint32_t want);
+
 /* lib tests */
 int arraytest(int, char **);
 int bitmaptest(int, char **);
@@ -57,9 +62,19 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int rwtest3(int, char **);
+int spinlocktest(int, char **);
+int futextest(int, char **);
+int atomictest(int, char **);
+int percputest(int, char **);
+int ringtest(int, char **);
+int workqueuetest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
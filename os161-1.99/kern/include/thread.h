@@ -72,6 +72,7 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -84,6 +85,47 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * While the thread is on a run queue these are protected by
+	 * that cpu's run queue lock; while it is running they belong
+	 * to the thread itself (and hardclock on its cpu).
+	 */
+	unsigned t_priority;		/* Run queue level; 0 is highest */
+	unsigned t_allotment;		/* Quanta used up at this level */
+	unsigned t_slice;		/* Hardclocks left in this quantum */
+	uint32_t t_affinity;		/* Cpus allowed, by bit (c_number) */
+
+	/*
+	 * Priority inheritance fields. t_inherit and t_blockedon are
+	 * protected by the priority inheritance lock in synch.c (and
+	 * t_inherit also by the run queue lock, as above); t_heldlocks
+	 * is only touched by the thread itself.
+	 */
+	unsigned t_inherit;		/* Level inherited; see thread_level */
+	struct lock *t_blockedon;	/* Lock we're asleep waiting for */
+	struct lock *t_heldlocks;	/* Sleep locks we hold */
+
+	/*
+	 * Timed sleep fields. Protected by the timer wheel lock in
+	 * clock.c.
+	 */
+	uint32_t t_wakeup;		/* Timer tick to wake up at */
+	struct thread *t_timernext;	/* Next sleeper in timer wheel slot */
+
+	/*
+	 * Accounting fields. Updated on the thread's cpu with the run
+	 * queue locked; anyone else reading them gets a snapshot that
+	 * may be slightly stale.
+	 */
+	uint64_t t_stamp;		/* Time of last state change (ns) */
+	uint64_t t_runtime;		/* Time spent running (ns) */
+	uint64_t t_waittime;		/* Time spent on a run queue (ns) */
+	uint64_t t_sleeptime;		/* Time spent in wchan_sleep (ns) */
+	unsigned t_nvcsw;		/* Switches from going to sleep */
+	unsigned t_nivcsw;		/* Switches from preemption or yield */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -157,16 +199,83 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge a hardclock to the current thread's quantum, and yield if
+ * the quantum has run out or a higher-priority thread is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_consider_preemption(void);
+
+/*
+ * Get or set the scheduling quantum, in hardclocks. This is the
+ * quantum at the highest priority level; it doubles at each level
+ * down. thread_setquantum returns EINVAL if the value is out of range.
+ */
+unsigned thread_getquantum(void);
+int thread_setquantum(int hardclocks);
+
+/*
+ * Priority inheritance.
+ *
+ * A thread holding a sleep lock runs at the best priority of the
+ * threads waiting for it, if that's better than its own, so that a
+ * low-priority owner can't hold up high-priority waiters for as long
+ * as it likes.
+ *
+ * thread_level returns the run queue level T runs at: the better of
+ * its own priority and the one it has inherited.
+ *
+ * thread_setinherit sets the level T inherits (RUNQUEUE_LEVELS for
+ * none), requeueing it if need be. Only for use by synch.c.
+ */
+unsigned thread_level(struct thread *t);
+void thread_setinherit(struct thread *t, unsigned level);
+
+/*
+ * CPU affinity.
+ *
+ * Each thread has a mask of the cpus it may run on, one bit per cpu
+ * number; new threads inherit their creator's. Wakeups and work
+ * stealing only place a thread on a cpu in its mask. A thread that
+ * finds itself running outside its mask (because the mask was just
+ * changed) moves at its next context switch, even if that leaves its
+ * cpu with nothing to run.
+ *
+ * thread_setaffinity returns EINVAL if MASK names no cpu that exists.
+ * If T is the current thread it yields to move off the current cpu if
+ * need be, so must not be called with spinlocks held in that case.
+ *
+ * thread_numcpus returns the number of cpus; they are numbered from 0.
+ */
+#define THREAD_AFFINITY_ALL	0xffffffff
+
+int thread_setaffinity(struct thread *t, uint32_t mask);
+uint32_t thread_getaffinity(struct thread *t);
+unsigned thread_numcpus(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Scheduling statistics.
+ *
+ * thread_getstats fills in SS for thread T, including the interval in
+ * progress; the caller must keep T from exiting meanwhile (e.g. by
+ * holding its process's p_lock). thread_printstats prints per-cpu
+ * busy and idle time and the load averages.
+ *
+ * thread_loadavg_update samples the number of runnable threads into
+ * the load averages; timerclock calls it every LOADAVG_INTERVAL
+ * seconds.
  */
-void thread_consider_migration(void);
+#define LOADAVG_INTERVAL	5
+
+struct schedstats;
+void thread_getstats(struct thread *t, struct schedstats *ss);
+void thread_printstats(void);
+void thread_loadavg_update(void);
 
 
 #endif /* _THREAD_H_ */
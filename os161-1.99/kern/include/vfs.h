@@ -192,5 +192,17 @@ void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
 bool vfs_biglock_do_i_hold(void);
 
+/*
+ * Reader-writer lock for the device list (and the bootfs vnode).
+ * Name lookups only need to read these, so they take it shared and
+ * don't have to go through the big lock to find where a path
+ * starts. Adding, mounting and unmounting devices and changing the
+ * bootfs take it exclusive. Lock order: this before the big lock.
+ */
+void vfs_devlock_acquire_read(void);
+void vfs_devlock_release_read(void);
+void vfs_devlock_acquire_write(void);
+void vfs_devlock_release_write(void);
+
 
 #endif /* _VFS_H_ */
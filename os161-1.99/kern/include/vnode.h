@@ -52,7 +52,7 @@ struct stat;
  * need to worry about it.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
+	volatile uint32_t vn_refcount;  /* Reference count (atomic) */
 	int vn_opencount;
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
@@ -32,15 +32,43 @@
 
 /*
  * Wait channel.
+ *
+ * A wait channel is only a name: the threads sleeping on it are kept
+ * in a sleep queue found by hashing its address, shared with other
+ * channels that hash to the same place. So channels can be embedded
+ * in other objects and set up and torn down for free.
+ *
+ * Each channel is in one of two tables of sleep queues. Lock waits
+ * go in WCHAN_TURNSTILE, everything else in WCHAN_SLEEPQ. Locking a
+ * channel locks its whole queue; a sleep queue may be held while
+ * locking a turnstile but not the other way around, and never two
+ * from the same table.
  */
 
+struct thread;
+struct lock;
+
+#define WCHAN_SLEEPQ	0	/* cvs, semaphores, everything else */
+#define WCHAN_TURNSTILE	1	/* sleep locks */
+#define WCHAN_NTABLES	2
 
-struct wchan; /* Opaque */
+struct wchan {
+	const char *wc_name;		/* name for this channel */
+	unsigned wc_table;		/* WCHAN_SLEEPQ or WCHAN_TURNSTILE */
+};
 
 /*
- * Create a wait channel. Use NAME as a symbolic name for the channel.
- * NAME should be a string constant; if not, the caller is responsible
- * for freeing it after the wchan is destroyed.
+ * Set up a wait channel in TABLE, using NAME as a symbolic name for
+ * it, and clean it up again. NAME must stay valid until cleanup.
+ * Nobody may be sleeping on the channel when it's cleaned up.
+ */
+void wchan_init(struct wchan *wc, const char *name, unsigned table);
+void wchan_cleanup(struct wchan *wc);
+
+/*
+ * Create a (WCHAN_SLEEPQ) wait channel. Use NAME as a symbolic name
+ * for the channel. NAME should be a string constant; if not, the
+ * caller is responsible for freeing it after the wchan is destroyed.
  */
 struct wchan *wchan_create(const char *name);
 
@@ -56,7 +84,7 @@ void wchan_destroy(struct wchan *wc);
 bool wchan_isempty(struct wchan *wc);
 
 /*
- * Lock and unlock the wait channel.
+ * Lock and unlock the wait channel. (This locks its sleep queue.)
  */
 void wchan_lock(struct wchan *wc);
 void wchan_unlock(struct wchan *wc);
@@ -81,5 +109,35 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up one particular thread, which must be asleep on the wait
+ * channel. For channels whose sleepers each wait for something
+ * different (e.g. their own timer deadline); the caller's protocol
+ * has to guarantee T is actually there.
+ */
+void wchan_wakethread(struct wchan *wc, struct thread *t);
+
+/*
+ * Wake up one thread sleeping on WC, and move the rest to sleep on
+ * TARGET instead without waking them. Neither channel should already
+ * be locked. WC must be a WCHAN_SLEEPQ channel and TARGET a
+ * WCHAN_TURNSTILE one. Returns the number of threads moved.
+ */
+unsigned wchan_wakeone_requeue(struct wchan *wc, struct wchan *target);
+
+/*
+ * Set t_blockedon to BLOCKEDON in each thread sleeping on WC that
+ * doesn't have it already, and return how many there were. The
+ * channel should not be locked; the caller must hold the lock that
+ * protects t_blockedon.
+ */
+unsigned wchan_markblocked(struct wchan *wc, struct lock *blockedon);
+
+/*
+ * Return the best run queue level (see thread_level) of the threads
+ * sleeping on the channel, or RUNQUEUE_LEVELS if there are none.
+ */
+unsigned wchan_toplevel(struct wchan *wc);
+
 
 #endif /* _WCHAN_H_ */
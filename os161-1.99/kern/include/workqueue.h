@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a worker thread and a queue of work for it. Work put
+ * on the queue runs later in the worker, in thread context, instead
+ * of in the thread that asked for it, which can get on with whatever
+ * it was doing. This is for cleanup that's expensive but not urgent,
+ * like freeing an exiting process's memory.
+ *
+ * The worker takes everything queued at once and runs it as a batch,
+ * and is only woken when work arrives at an empty queue, so a burst
+ * of work costs one wakeup.
+ *
+ *    workqueue_schedule - run FUNC(ARG) later. Allocates the work
+ *                         item; returns ENOMEM if that fails, in
+ *                         which case nothing was queued.
+ *    workqueue_add      - queue a caller-supplied work item, which
+ *                         can't fail. If the item is already queued
+ *                         and hasn't started running yet, this does
+ *                         nothing, so one item can stand for "there
+ *                         is some of this to do". Safe to call with
+ *                         interrupts off, but not with spinlocks held.
+ *
+ * Work goes on the queue of the cpu it's queued from. Before
+ * workqueue_bootstrap has started the workers, work runs right away
+ * in the caller instead.
+ */
+
+struct work {
+	struct work *w_next;		/* Next on the queue */
+	void (*w_func)(void *);		/* Function to run */
+	void *w_arg;			/* Argument for it */
+	volatile uint32_t w_pending;	/* Queued and not yet started */
+	bool w_alloced;			/* From workqueue_schedule; free it */
+};
+
+#define WORK_INITIALIZER(func, arg)	{ NULL, func, arg, 0, false }
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+
+void workqueue_bootstrap(void);
+int workqueue_schedule(void (*func)(void *), void *arg);
+void workqueue_add(struct work *w);
+void workqueue_printstats(void);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock-free ring buffers. See ring.h for details.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <ring.h>
+
+/*
+ * Round a ring size up to a power of two, so positions can be turned
+ * into slot numbers with a mask and can run freely around 2^32.
+ */
+static
+unsigned
+ring_roundsize(unsigned size)
+{
+	unsigned n;
+
+	KASSERT(size > 0 && size <= 0x80000000);
+	for (n = 1; n < size; n *= 2) {
+		/* nothing */
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Single producer, single consumer.
+//
+// The producer only writes sr_tail and the consumer only writes
+// sr_head. The producer fills slots and then advances sr_tail past
+// them; the consumer empties slots and then advances sr_head. The
+// barriers make sure the other side never sees the index move before
+// the slots behind it are ready.
+
+struct spscring *
+spscring_create(unsigned size)
+{
+	struct spscring *r;
+
+	size = ring_roundsize(size);
+
+	r = kmalloc(sizeof(*r));
+	if (r == NULL) {
+		return NULL;
+	}
+	r->sr_slots = kmalloc(size * sizeof(void *));
+	if (r->sr_slots == NULL) {
+		kfree(r);
+		return NULL;
+	}
+	r->sr_head = 0;
+	r->sr_tail = 0;
+	r->sr_mask = size - 1;
+	return r;
+}
+
+void
+spscring_destroy(struct spscring *r)
+{
+	KASSERT(spscring_empty(r));
+	kfree((void *)r->sr_slots);
+	kfree(r);
+}
+
+unsigned
+spscring_enqueue_batch(struct spscring *r, void **ptrs, unsigned n)
+{
+	uint32_t head, tail;
+	unsigned i, space;
+
+	tail = r->sr_tail;
+	head = r->sr_head;
+	/* don't overwrite slots before the consumer is done reading them */
+	membar_load_any();
+
+	space = r->sr_mask + 1 - (tail - head);
+	if (n > space) {
+		n = space;
+	}
+	for (i=0; i<n; i++) {
+		KASSERT(ptrs[i] != NULL);
+		r->sr_slots[(tail + i) & r->sr_mask] = ptrs[i];
+	}
+
+	membar_store_store();
+	r->sr_tail = tail + n;
+	return n;
+}
+
+unsigned
+spscring_dequeue_batch(struct spscring *r, void **ptrs, unsigned max)
+{
+	uint32_t head, tail;
+	unsigned i, n;
+
+	head = r->sr_head;
+	tail = r->sr_tail;
+	/* don't read slots before seeing that they're full */
+	membar_load_load();
+
+	n = tail - head;
+	if (n > max) {
+		n = max;
+	}
+	for (i=0; i<n; i++) {
+		ptrs[i] = r->sr_slots[(head + i) & r->sr_mask];
+	}
+
+	membar_load_any();
+	r->sr_head = head + n;
+	return n;
+}
+
+int
+spscring_enqueue(struct spscring *r, void *ptr)
+{
+	if (spscring_enqueue_batch(r, &ptr, 1) == 0) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void *
+spscring_dequeue(struct spscring *r)
+{
+	void *ptr;
+
+	if (spscring_dequeue_batch(r, &ptr, 1) == 0) {
+		return NULL;
+	}
+	return ptr;
+}
+
+bool
+spscring_empty(struct spscring *r)
+{
+	return r->sr_head == r->sr_tail;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Multiple producers, multiple consumers.
+//
+// Slot number i starts with sequence number i. A producer may fill the
+// slot for position P when its sequence number is P; it then sets it
+// to P+1, which tells consumers the slot is full. A consumer may empty
+// the slot for position P when its sequence number is P+1; it then
+// sets it to P+size, making it ready for the producer one lap later.
+// Positions are claimed by moving mr_tail or mr_head forward with
+// atomic_cas. A sequence number behind the position means the ring is
+// full (for producers) or empty (for consumers); one ahead of it means
+// somebody else claimed the position first and we need to look again.
+
+struct mpmcring *
+mpmcring_create(unsigned size)
+{
+	struct mpmcring *r;
+	unsigned i;
+
+	size = ring_roundsize(size);
+
+	r = kmalloc(sizeof(*r));
+	if (r == NULL) {
+		return NULL;
+	}
+	r->mr_slots = kmalloc(size * sizeof(struct mpmcring_slot));
+	if (r->mr_slots == NULL) {
+		kfree(r);
+		return NULL;
+	}
+	for (i=0; i<size; i++) {
+		r->mr_slots[i].ms_seq = i;
+		r->mr_slots[i].ms_ptr = NULL;
+	}
+	r->mr_head = 0;
+	r->mr_tail = 0;
+	r->mr_mask = size - 1;
+	return r;
+}
+
+void
+mpmcring_destroy(struct mpmcring *r)
+{
+	KASSERT(mpmcring_empty(r));
+	kfree(r->mr_slots);
+	kfree(r);
+}
+
+unsigned
+mpmcring_enqueue_batch(struct mpmcring *r, void **ptrs, unsigned n)
+{
+	struct mpmcring_slot *slot;
+	uint32_t pos, seq;
+	unsigned i, k;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	/* Claim as many free slots in a row as we can, up to N. */
+	while (1) {
+		pos = r->mr_tail;
+		membar_load_load();
+		seq = 0;
+		for (k=0; k<n; k++) {
+			seq = r->mr_slots[(pos + k) & r->mr_mask].ms_seq;
+			if (seq != pos + k) {
+				break;
+			}
+		}
+		if (k > 0) {
+			if (atomic_cas(&r->mr_tail, pos, pos + k) == pos) {
+				break;
+			}
+		}
+		else if ((int32_t)(seq - pos) < 0) {
+			/* full */
+			return 0;
+		}
+	}
+	membar_load_any();
+
+	/* The slots are ours; fill them and pass them to consumers. */
+	for (i=0; i<k; i++) {
+		KASSERT(ptrs[i] != NULL);
+		slot = &r->mr_slots[(pos + i) & r->mr_mask];
+		slot->ms_ptr = ptrs[i];
+		membar_store_store();
+		slot->ms_seq = pos + i + 1;
+	}
+	return k;
+}
+
+unsigned
+mpmcring_dequeue_batch(struct mpmcring *r, void **ptrs, unsigned max)
+{
+	struct mpmcring_slot *slot;
+	uint32_t pos, seq;
+	unsigned i, k;
+
+	if (max == 0) {
+		return 0;
+	}
+
+	/* Claim as many full slots in a row as we can, up to MAX. */
+	while (1) {
+		pos = r->mr_head;
+		membar_load_load();
+		seq = 0;
+		for (k=0; k<max; k++) {
+			seq = r->mr_slots[(pos + k) & r->mr_mask].ms_seq;
+			if (seq != pos + k + 1) {
+				break;
+			}
+		}
+		if (k > 0) {
+			if (atomic_cas(&r->mr_head, pos, pos + k) == pos) {
+				break;
+			}
+		}
+		else if ((int32_t)(seq - (pos + 1)) < 0) {
+			/* empty */
+			return 0;
+		}
+	}
+	membar_load_load();
+
+	/* Empty the slots and pass them back to producers. */
+	for (i=0; i<k; i++) {
+		slot = &r->mr_slots[(pos + i) & r->mr_mask];
+		ptrs[i] = slot->ms_ptr;
+		membar_load_any();
+		slot->ms_seq = pos + i + r->mr_mask + 1;
+	}
+	return k;
+}
+
+int
+mpmcring_enqueue(struct mpmcring *r, void *ptr)
+{
+	if (mpmcring_enqueue_batch(r, &ptr, 1) == 0) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void *
+mpmcring_dequeue(struct mpmcring *r)
+{
+	void *ptr;
+
+	if (mpmcring_dequeue_batch(r, &ptr, 1) == 0) {
+		return NULL;
+	}
+	return ptr;
+}
+
+bool
+mpmcring_empty(struct mpmcring *r)
+{
+	return r->mr_head == r->mr_tail;
+}
@@ -43,12 +43,16 @@
  */
 
 #include <types.h>
+#include <kern/sched.h>
+#include <lib.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <atomic.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>  
 #include "opt-A2.h"
 #include <array.h>
@@ -58,17 +62,32 @@
  */
 struct proc *kproc;
 #if OPT_A2
-	volatile pid_t currPID = PID_MIN;
+/*
+ * The process table (see proc.h): chunks of PROC_CHUNK entries,
+ * allocated as PIDs run out, and a FIFO list of free PIDs threaded
+ * through nextFree.
+ *
+ * procChunks and procNumChunks only ever grow, under procGrowLock; a
+ * chunk is filled in before procNumChunks counts it, so lookups need
+ * no lock. procGrowLock is a spinlock, so the table can be set up in
+ * proc_bootstrap before there are any threads. procFreeLock protects
+ * the free list. It nests inside the entry locks, which nest inside
+ * procGrowLock.
+ */
+#define PROC_NCHUNKS ((PID_MAX + 1) / PROC_CHUNK)
+static procWrapper* procChunks[PROC_NCHUNKS];
+static volatile unsigned procNumChunks;
+static struct spinlock procGrowLock = SPINLOCK_INITIALIZER;
+static struct spinlock procFreeLock = SPINLOCK_INITIALIZER;
+static pid_t procFreeHead = -1;
+static pid_t procFreeTail = -1;
 #endif 
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
 #ifdef UW
-/* count of the number of processes, excluding kproc */
-static volatile unsigned int proc_count;
-/* provides mutual exclusion for proc_count */
-/* it would be better to use a lock here, but we use a semaphore because locks are not implemented in the base kernel */ 
-static struct semaphore *proc_count_mutex;
+/* count of the number of processes, excluding kproc; updated atomically */
+static volatile uint32_t proc_count;
 /* used to signal the kernel menu thread when there are no processes */
 struct semaphore *no_proc_sem;   
 #endif  // UW
@@ -101,9 +120,396 @@ static struct proc* proc_create(const char *name) {
 	proc->console = NULL;
 #endif // UW
 
+#if OPT_A2
+	proc->procPID = -1;
+	proc->p_vforkSem = NULL;
+#endif
+
 	return proc;
 }
 
+#if OPT_A2
+/* The entry for PID, which must be in an allocated chunk. */
+static procWrapper* procEntry(pid_t pid) {
+	return &procChunks[pid / PROC_CHUNK][pid % PROC_CHUNK];
+}
+
+/* True if PID is in an allocated chunk. */
+static bool procValid(pid_t pid) {
+	bool valid;
+
+	valid = pid >= PID_MIN && pid <= PID_MAX &&
+		(unsigned)pid / PROC_CHUNK < procNumChunks;
+	/* don't look in the chunk before seeing it counted */
+	membar_load_load();
+	return valid;
+}
+
+/*
+ * Put PID at the end of the free list, so it's reused last. Its
+ * entry should be locked (and its parent's, if it has one).
+ */
+static void procFree(pid_t pid) {
+	procWrapper* entry = procEntry(pid);
+
+	KASSERT(entry->proc == NULL);
+	KASSERT(entry->firstChild == -1);
+	entry->inUse = false;
+	entry->parentPID = -1;
+	entry->nextSibling = -1;
+	entry->firstExited = -1;
+	entry->lastExited = -1;
+	entry->nextExited = -1;
+	entry->nextFree = -1;
+
+	spinlock_acquire(&procFreeLock);
+	if (procFreeTail == -1) {
+		procFreeHead = pid;
+	} else {
+		procEntry(procFreeTail)->nextFree = pid;
+	}
+	procFreeTail = pid;
+	spinlock_release(&procFreeLock);
+}
+
+/* Set up or tear down the entries of a chunk. */
+static void procChunkInit(procWrapper* chunk) {
+	int i;
+
+	for (i = 0; i < PROC_CHUNK; i++) {
+		spinlock_init(&chunk[i].entryLock);
+		chunk[i].proc = NULL;
+		chunk[i].parentPID = -1;
+		chunk[i].exitCode = 0;
+		chunk[i].inUse = false;
+		chunk[i].firstChild = -1;
+		chunk[i].nextSibling = -1;
+		chunk[i].firstExited = -1;
+		chunk[i].lastExited = -1;
+		chunk[i].nextExited = -1;
+		chunk[i].nextFree = -1;
+		wchan_init(&chunk[i].childWchan, "procwait", WCHAN_SLEEPQ);
+	}
+}
+
+static void procChunkCleanup(procWrapper* chunk) {
+	int i;
+
+	for (i = 0; i < PROC_CHUNK; i++) {
+		wchan_cleanup(&chunk[i].childWchan);
+		spinlock_cleanup(&chunk[i].entryLock);
+	}
+}
+
+/*
+ * Add a chunk to the table and its PIDs to the free list. Fails with
+ * ENPROC once the table covers every PID up to PID_MAX. The chunk is
+ * allocated before taking procGrowLock; if somebody else grew the
+ * table meanwhile, it's thrown away again.
+ */
+static int procGrow(void) {
+	procWrapper* chunk;
+	pid_t base, pid;
+	int i, result;
+
+	if (procNumChunks == PROC_NCHUNKS) {
+		return ENPROC;
+	}
+	chunk = kmalloc(PROC_CHUNK * sizeof(procWrapper));
+	if (chunk == NULL) {
+		return ENOMEM;
+	}
+	procChunkInit(chunk);
+
+	spinlock_acquire(&procGrowLock);
+	if (procFreeHead != -1 || procNumChunks == PROC_NCHUNKS) {
+		result = procFreeHead != -1 ? 0 : ENPROC;
+		spinlock_release(&procGrowLock);
+		procChunkCleanup(chunk);
+		kfree(chunk);
+		return result;
+	}
+
+	base = procNumChunks * PROC_CHUNK;
+	procChunks[procNumChunks] = chunk;
+	membar_store_store();
+	procNumChunks++;
+
+	for (i = 0; i < PROC_CHUNK; i++) {
+		pid = base + i;
+		if (pid >= PID_MIN) {
+			spinlock_acquire(&procEntry(pid)->entryLock);
+			procFree(pid);
+			spinlock_release(&procEntry(pid)->entryLock);
+		}
+	}
+	spinlock_release(&procGrowLock);
+	return 0;
+}
+
+/* Give PROC a PID, growing the table if there are none free. */
+static int procAlloc(struct proc* proc) {
+	procWrapper* entry;
+	pid_t pid;
+	int result;
+
+	while (1) {
+		spinlock_acquire(&procFreeLock);
+		pid = procFreeHead;
+		if (pid != -1) {
+			procFreeHead = procEntry(pid)->nextFree;
+			if (procFreeHead == -1) {
+				procFreeTail = -1;
+			}
+			spinlock_release(&procFreeLock);
+			break;
+		}
+		spinlock_release(&procFreeLock);
+
+		result = procGrow();
+		if (result) {
+			return result;
+		}
+	}
+
+	entry = procEntry(pid);
+	spinlock_acquire(&entry->entryLock);
+	KASSERT(!entry->inUse);
+	entry->proc = proc;
+	entry->parentPID = -1;
+	entry->exitCode = 0;
+	entry->inUse = true;
+	entry->firstChild = -1;
+	entry->nextSibling = -1;
+	entry->firstExited = -1;
+	entry->lastExited = -1;
+	entry->nextExited = -1;
+	spinlock_release(&entry->entryLock);
+	proc->procPID = pid;
+	return 0;
+}
+
+/*
+ * Lock ENTRY and its parent, if it has one, parent first. Returns the
+ * parent, or NULL. The parent can only change from a real PID to -1
+ * (when the parent exits), so one retry is enough.
+ */
+static procWrapper* procLockWithParent(procWrapper* entry) {
+	procWrapper* parent;
+	pid_t ppid;
+
+	while (1) {
+		ppid = entry->parentPID;
+		parent = ppid == -1 ? NULL : procEntry(ppid);
+		if (parent != NULL) {
+			spinlock_acquire(&parent->entryLock);
+		}
+		spinlock_acquire(&entry->entryLock);
+		if (entry->parentPID == ppid) {
+			return parent;
+		}
+		spinlock_release(&entry->entryLock);
+		if (parent != NULL) {
+			spinlock_release(&parent->entryLock);
+		}
+	}
+}
+
+/*
+ * Check that PID is on PARENT's list of children. Only PARENT need be
+ * locked, so this is safe to ask before locking PID's entry, which
+ * must come after PARENT's.
+ */
+static bool procIsChild(procWrapper* parent, pid_t pid) {
+	pid_t p;
+
+	for (p = parent->firstChild; p != -1; p = procEntry(p)->nextSibling) {
+		if (p == pid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Take PID off PARENT's list of children. Both should be locked. */
+static void procUnlink(procWrapper* parent, pid_t pid) {
+	pid_t* link;
+
+	link = &parent->firstChild;
+	while (*link != pid) {
+		KASSERT(*link != -1);
+		link = &procEntry(*link)->nextSibling;
+	}
+	*link = procEntry(pid)->nextSibling;
+}
+
+/* Take PID off PARENT's list of exited children. Both locked. */
+static void procUnlinkExited(procWrapper* parent, pid_t pid) {
+	pid_t* link;
+	pid_t prev = -1;
+
+	link = &parent->firstExited;
+	while (*link != pid) {
+		KASSERT(*link != -1);
+		prev = *link;
+		link = &procEntry(*link)->nextExited;
+	}
+	*link = procEntry(pid)->nextExited;
+	if (parent->lastExited == pid) {
+		parent->lastExited = prev;
+	}
+}
+
+procWrapper* procLookup(pid_t pid) {
+	procWrapper* entry;
+
+	if (!procValid(pid)) {
+		return NULL;
+	}
+	entry = procEntry(pid);
+	spinlock_acquire(&entry->entryLock);
+	if (!entry->inUse || entry->proc == NULL) {
+		spinlock_release(&entry->entryLock);
+		return NULL;
+	}
+	return entry;
+}
+
+void procUnlock(pid_t pid) {
+	spinlock_release(&procEntry(pid)->entryLock);
+}
+
+void procAddChild(struct proc* parent, struct proc* child) {
+	procWrapper* parentEntry = procEntry(parent->procPID);
+	procWrapper* childEntry = procEntry(child->procPID);
+
+	spinlock_acquire(&parentEntry->entryLock);
+	spinlock_acquire(&childEntry->entryLock);
+	KASSERT(childEntry->parentPID == -1);
+	childEntry->parentPID = parent->procPID;
+	childEntry->nextSibling = parentEntry->firstChild;
+	parentEntry->firstChild = child->procPID;
+	spinlock_release(&childEntry->entryLock);
+	spinlock_release(&parentEntry->entryLock);
+}
+
+void procExit(struct proc* p, int exitcode) {
+	procWrapper* self = procEntry(p->procPID);
+	procWrapper* parent;
+	procWrapper* child;
+	pid_t pid, next;
+
+	KASSERT(self->proc == p);
+
+	// orphan the children first; nobody will wait for them now, so
+	// any that have already exited can be reaped right away. We're
+	// exiting, so no more can be added behind our back.
+	spinlock_acquire(&self->entryLock);
+	pid = self->firstChild;
+	while (pid != -1) {
+		child = procEntry(pid);
+		spinlock_acquire(&child->entryLock);
+		next = child->nextSibling;
+		child->parentPID = -1;
+		child->nextSibling = -1;
+		child->nextExited = -1;
+		if (child->proc == NULL) {
+			procFree(pid);
+		}
+		spinlock_release(&child->entryLock);
+		pid = next;
+	}
+	self->firstChild = -1;
+	self->firstExited = -1;
+	self->lastExited = -1;
+	spinlock_release(&self->entryLock);
+
+	// then tell the parent, if there still is one; it reaps us in
+	// waitpid. Otherwise our PID can go back now.
+	parent = procLockWithParent(self);
+	self->proc = NULL;
+	self->exitCode = exitcode;
+	if (parent != NULL) {
+		self->nextExited = -1;
+		if (parent->lastExited == -1) {
+			parent->firstExited = p->procPID;
+		} else {
+			procEntry(parent->lastExited)->nextExited = p->procPID;
+		}
+		parent->lastExited = p->procPID;
+		spinlock_release(&self->entryLock);
+		wchan_wakeall(&parent->childWchan);
+		spinlock_release(&parent->entryLock);
+	} else {
+		procFree(p->procPID);
+		spinlock_release(&self->entryLock);
+	}
+
+	// the PID is taken care of; proc_destroy needn't look at it
+	p->procPID = -1;
+}
+
+int procWait(pid_t pid, bool nohang, pid_t* retpid, int* exitcode) {
+	procWrapper* self = procEntry(curproc->procPID);
+	procWrapper* child = NULL;
+
+	if (pid != -1 && (!procValid(pid) || pid == curproc->procPID)) {
+		return ESRCH;
+	}
+
+	// a child's exit state can't change without our lock, so sleep
+	// on our own channel until one we want has exited
+	spinlock_acquire(&self->entryLock);
+	while (1) {
+		if (pid == -1) {
+			if (self->firstExited != -1) {
+				pid = self->firstExited;
+				child = procEntry(pid);
+				spinlock_acquire(&child->entryLock);
+				break;
+			}
+			if (self->firstChild == -1) {
+				spinlock_release(&self->entryLock);
+				return ECHILD;
+			}
+		} else {
+			// not a child's lock, or we'd be taking it out of order
+			if (!procIsChild(self, pid)) {
+				spinlock_release(&self->entryLock);
+				return ESRCH;
+			}
+			child = procEntry(pid);
+			spinlock_acquire(&child->entryLock);
+			KASSERT(child->inUse);
+			KASSERT(child->parentPID == curproc->procPID);
+			if (child->proc == NULL) {
+				break;
+			}
+			spinlock_release(&child->entryLock);
+		}
+		if (nohang) {
+			spinlock_release(&self->entryLock);
+			*retpid = 0;
+			return 0;
+		}
+		wchan_lock(&self->childWchan);
+		spinlock_release(&self->entryLock);
+		wchan_sleep(&self->childWchan);
+		spinlock_acquire(&self->entryLock);
+	}
+
+
+	*retpid = pid;
+	*exitcode = child->exitCode;
+	procUnlinkExited(self, pid);
+	procUnlink(self, pid);
+	procFree(pid);
+	spinlock_release(&child->entryLock);
+	spinlock_release(&self->entryLock);
+	return 0;
+}
+#endif /* OPT_A2 */
+
 /*
  * Destroy a proc structure.
  */
@@ -126,6 +532,29 @@ void proc_destroy(struct proc *proc) {
 	 * incorrect to destroy it.)
 	 */
 
+#if OPT_A2
+	/*
+	 * A process that exits through sys__exit has dealt with its PID
+	 * already. One that never ran (fork failed after creating it)
+	 * still holds its PID; give it back.
+	 */
+	if (proc->procPID != -1) {
+		procWrapper* entry = procEntry(proc->procPID);
+		procWrapper* parent = procLockWithParent(entry);
+
+		KASSERT(entry->proc == proc);
+		entry->proc = NULL;
+		if (parent != NULL) {
+			procUnlink(parent, proc->procPID);
+		}
+		procFree(proc->procPID);
+		spinlock_release(&entry->entryLock);
+		if (parent != NULL) {
+			spinlock_release(&parent->entryLock);
+		}
+	}
+#endif
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -170,14 +599,11 @@ void proc_destroy(struct proc *proc) {
         /* note: kproc is not included in the process count, but proc_destroy
 	   is never called on kproc (see KASSERT above), so we're OK to decrement
 	   the proc_count unconditionally here */
-	P(proc_count_mutex); 
 	KASSERT(proc_count > 0);
-	proc_count--;
 	/* signal the kernel menu thread if the process count has reached zero */
-	if (proc_count == 0) {
+	if (atomic_dec(&proc_count) == 0) {
 	  V(no_proc_sem);
 	}
-	V(proc_count_mutex);
 #endif // UW
 
 }
@@ -193,10 +619,6 @@ proc_bootstrap(void) {
   }
 #ifdef UW
   proc_count = 0;
-  proc_count_mutex = sem_create("proc_count_mutex",1);
-  if (proc_count_mutex == NULL) {
-    panic("could not create proc_count_mutex semaphore\n");
-  }
   no_proc_sem = sem_create("no_proc_sem",0);
   if (no_proc_sem == NULL) {
     panic("could not create no_proc_sem semaphore\n");
@@ -205,25 +627,9 @@ proc_bootstrap(void) {
 
 // do an initialization for lock and the array of process wrappers 
 #if OPT_A2
-	
-	// initialize lock for process 
-	procLock = lock_create("process lock");
-	if (procLock == NULL) {
-		panic("failed initializing lock for process");
-	}
-	// all elements should have nothing right now
-	// proc is NULL;
-	// -1 represents no parent process
-	// 0 for exit code
-	// initialize condition variables
-	for (int i = 0; i < 128; i++) {
-		allProcess[i].proc = NULL;
-		allProcess[i].parentPID = -1;
-		allProcess[i].exitCode = 0;
-		allProcess[i].procCV = cv_create("process cv");
-		if (allProcess[i].procCV == NULL) {
-			panic("failed initializing condition variable for each process");
-		}
+	// start the process table with one chunk; it grows as needed
+	if (procGrow() != 0) {
+		panic("failed initializing process table");
 	}
 #endif
 }
@@ -237,6 +643,9 @@ proc_bootstrap(void) {
 struct proc* proc_create_runprogram(const char *name) {
 	struct proc *proc;
 	char *console_path;
+#if OPT_A2
+	int result;
+#endif
 
 	proc = proc_create(name);
 	if (proc == NULL) {
@@ -282,16 +691,15 @@ struct proc* proc_create_runprogram(const char *name) {
 	/* increment the count of processes */
         /* we are assuming that all procs, including those created by fork(),
            are created using a call to proc_create_runprogram  */
-	P(proc_count_mutex); 
-	proc_count++;
-	V(proc_count_mutex);
+	atomic_inc(&proc_count);
 #endif // UW 
 #if OPT_A2
-	lock_acquire(procLock);
-	allProcess[currPID].proc = proc;
-	proc->procPID = currPID;
-	currPID += 1;
-	lock_release(procLock);
+	result = procAlloc(proc);
+	if (result) {
+		/* proc_destroy also takes it back out of proc_count */
+		proc_destroy(proc);
+		return NULL;
+	}
 #endif 
 	return proc;
 }
@@ -382,3 +790,75 @@ struct addrspace* curproc_setas(struct addrspace *newas) {
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+/*
+ * Print scheduling statistics for the threads of one process. They
+ * are copied out under p_lock, which keeps the threads from exiting,
+ * and printed afterwards because kprintf may sleep. For user
+ * processes the table entry is locked by procLookup, which keeps the
+ * process itself around; it's unlocked here.
+ */
+#define PS_MAXTHREADS 16
+
+static
+void
+proc_printstats_one(struct proc *proc, pid_t pid)
+{
+	static const char statechars[] = { 'R', 'Q', 'S', 'Z' };
+	struct schedstats ss[PS_MAXTHREADS];
+	char names[PS_MAXTHREADS][17];
+	char states[PS_MAXTHREADS];
+	unsigned prios[PS_MAXTHREADS];
+	struct thread *t;
+	unsigned i, num, shown;
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	shown = num < PS_MAXTHREADS ? num : PS_MAXTHREADS;
+	for (i = 0; i < shown; i++) {
+		t = threadarray_get(&proc->p_threads, i);
+		thread_getstats(t, &ss[i]);
+		snprintf(names[i], sizeof(names[i]), "%s", t->t_name);
+		states[i] = statechars[t->t_state];
+		prios[i] = thread_level(t);
+	}
+	spinlock_release(&proc->p_lock);
+#if OPT_A2
+	if (proc != kproc) {
+		procUnlock(pid);
+	}
+#endif
+
+	for (i = 0; i < shown; i++) {
+		kprintf("%5d  %-16s %c %3u %9llu %9llu %9llu %6u %6u\n",
+			pid, names[i], states[i], prios[i],
+			ss[i].ss_runtime / 1000000,
+			ss[i].ss_waittime / 1000000,
+			ss[i].ss_sleeptime / 1000000,
+			ss[i].ss_nvcsw, ss[i].ss_nivcsw);
+	}
+	if (num > shown) {
+		kprintf("%5d  (%u more threads)\n", pid, num - shown);
+	}
+}
+
+void
+proc_printstats(void)
+{
+#if OPT_A2
+	procWrapper* entry;
+	pid_t i;
+#endif
+
+	kprintf("  pid  name             S pri   run(ms)  wait(ms) "
+		"sleep(ms)   vcsw  ivcsw\n");
+	proc_printstats_one(kproc, 0);
+#if OPT_A2
+	for (i = PID_MIN; (unsigned)i < procNumChunks * PROC_CHUNK; i++) {
+		entry = procLookup(i);
+		if (entry != NULL) {
+			proc_printstats_one(entry->proc, i);
+		}
+	}
+#endif
+}
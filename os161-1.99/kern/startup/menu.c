@@ -38,13 +38,16 @@
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
+#include <lockstat.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <workqueue.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
 #include "opt-A2.h"
 
 /*
@@ -260,6 +263,35 @@ static int enable_DB_THREADS(int nargs, char** args) {
   return 0;
 }
 
+/*
+ * Command for showing or changing the scheduling quantum.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	unsigned q;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: quantum [hardclocks]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		result = thread_setquantum(atoi(args[1]));
+		if (result) {
+			kprintf("quantum: must be between 1 and %d\n", HZ);
+			return result;
+		}
+	}
+
+	q = thread_getquantum();
+	kprintf("Quantum is %u hardclocks (%u ms) at the top priority\n",
+		q, q * 1000 / HZ);
+	return 0;
+}
+
 /*
  * Command for running sync.
  */
@@ -400,6 +432,45 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+	workqueue_printstats();
+	kprintf("\n");
+	proc_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for the lock contention report; "lockstat reset" zeroes it
+ * first, so the report after a workload covers just that workload.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: lockstat [reset]\n");
+		return EINVAL;
+	}
+
+	lockstat_report();
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -449,6 +520,7 @@ static const char *opsmenu[] = {
 	"[bootfs]  Set \"boot\" filesystem   ",
 	"[pf]      Print a file              ",
 	"[dth]     Enable DB_THREADS         ",
+	"[quantum] Show/set sched quantum    ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
@@ -476,12 +548,22 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread affinity test          ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[rw1] Rwlock consistency test       ",
+	"[rw2] Rwlock sharing test           ",
+	"[rw3] Rwlock writer preference test ",
+	"[sl1] Spinlock stress test          ",
+	"[fx1] Futex wait/wake test          ",
+	"[atm1] Atomic operations test       ",
+	"[pc1] Per-cpu counter test          ",
+	"[rb1] Ring buffer test              ",
+	"[wq1] Workqueue test                ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -522,6 +604,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ps] Thread and cpu sched stats     ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention report   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -564,6 +650,7 @@ static struct {
 	{ "sync",	cmd_sync },
 	{ "panic",	cmd_panic },
 	{ "dth",        enable_DB_THREADS},
+	{ "quantum",	cmd_quantum },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -579,6 +666,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ps",		cmd_ps },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -591,11 +682,21 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "rw1",	rwtest },
+	{ "rw2",	rwtest2 },
+	{ "rw3",	rwtest3 },
+	{ "sl1",	spinlocktest },
+	{ "fx1",	futextest },
+	{ "atm1",	atomictest },
+	{ "pc1",	percputest },
+	{ "rb1",	ringtest },
+	{ "wq1",	workqueuetest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
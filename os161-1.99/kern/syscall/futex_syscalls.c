@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <syscall.h>
+
+/*
+ * Futexes: sleeping on, and waking, a word of user memory.
+ *
+ * User code does its locking with atomic operations on ordinary
+ * memory and only calls in here when it has to wait for, or wake up,
+ * somebody else. The kernel keeps no state about a futex except the
+ * threads sleeping on it.
+ *
+ * Waiters are keyed by the physical address of the word, so that two
+ * processes sharing a page find each other regardless of where they
+ * each have it mapped. Each waiter puts a struct futex_waiter on its
+ * own stack on one of FUTEX_BUCKETS hash chains and sleeps on that
+ * bucket's wait channel; futex_wake takes matching waiters off the
+ * chain and wakes them individually with wchan_wakethread.
+ *
+ * The value check in futex_wait happens under the bucket lock, as
+ * does the unlinking in futex_wake, so a wakeup issued after user
+ * code changes the word can't slip in between the check and the
+ * sleep. The word is read through the kernel's direct mapping of
+ * its physical page rather than with copyin, so that can be done
+ * while holding a spinlock.
+ *
+ * Lock ordering: bucket lock, then the bucket's wchan lock.
+ */
+
+#define FUTEX_BUCKETS	64
+
+struct futex_waiter {
+	paddr_t fw_key;
+	struct thread *fw_thread;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_waiter *fb_waiters;
+	struct wchan *fb_wchan;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_BUCKETS];
+
+/*
+ * Setup.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < FUTEX_BUCKETS; i++) {
+		spinlock_init(&futex_buckets[i].fb_lock);
+		futex_buckets[i].fb_waiters = NULL;
+		futex_buckets[i].fb_wchan = wchan_create("futex");
+		if (futex_buckets[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(paddr_t key)
+{
+	/* Multiplicative hash; the low two bits are always zero. */
+	return &futex_buckets[((key >> 2) * 2654435761U) % FUTEX_BUCKETS];
+}
+
+/*
+ * Find the physical address of the user word at UADDR.
+ *
+ * Kernel threads have no user memory, so for them (which in practice
+ * means the fx1 test) UADDR may be a word in the kernel's
+ * direct-mapped segment instead.
+ */
+static
+int
+futex_key(userptr_t uaddr, paddr_t *ret)
+{
+	vaddr_t va = (vaddr_t)uaddr;
+	struct addrspace *as;
+
+	if (va % sizeof(int32_t) != 0) {
+		return EINVAL;
+	}
+	if (va >= USERSPACETOP) {
+		if (curproc == kproc && va < MIPS_KSEG1) {
+			*ret = KVADDR_TO_PADDR(va);
+			return 0;
+		}
+		return EFAULT;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_translate(as, va, ret);
+}
+
+/*
+ * Sleep until woken by futex_wake, provided the word at UADDR still
+ * contains VAL. Fails with EAGAIN if it doesn't.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int32_t val)
+{
+	struct futex_waiter fw;
+	struct futex_bucket *fb;
+	int result;
+
+	result = futex_key(uaddr, &fw.fw_key);
+	if (result) {
+		return result;
+	}
+	fw.fw_thread = curthread;
+	fb = futex_hash(fw.fw_key);
+
+	spinlock_acquire(&fb->fb_lock);
+	if (*(volatile int32_t *)PADDR_TO_KVADDR(fw.fw_key) != val) {
+		spinlock_release(&fb->fb_lock);
+		return EAGAIN;
+	}
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+	/* As in timer_sleep: be asleep before futex_wake can find us. */
+	wchan_lock(fb->fb_wchan);
+	spinlock_release(&fb->fb_lock);
+	wchan_sleep(fb->fb_wchan);
+
+	return 0;
+}
+
+/*
+ * Wake up to COUNT threads waiting on the word at UADDR. Hands back
+ * the number actually woken.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int32_t *retval)
+{
+	struct futex_waiter **fwp, *fw;
+	struct futex_bucket *fb;
+	paddr_t key;
+	int result, woken;
+
+	if (count < 0) {
+		return EINVAL;
+	}
+	result = futex_key(uaddr, &key);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(key);
+
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (woken < count && *fwp != NULL) {
+		fw = *fwp;
+		if (fw->fw_key != key) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		/* FW lives on its thread's stack; done with it after this. */
+		wchan_wakethread(fb->fb_wchan, fw->fw_thread);
+		woken++;
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
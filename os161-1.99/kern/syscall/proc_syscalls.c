@@ -14,6 +14,9 @@
 #include <mips/trapframe.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <workqueue.h>
+#include <percpu.h>
+#include <atomic.h>
 
 
   /* this implementation of sys__exit does not do anything with the exit code */
@@ -23,6 +26,26 @@ static void threadForkWrapper(void* ptr, unsigned long num) {
   (void) num;
   enter_forked_process((struct trapframe*) ptr);
 }
+// Freeing an address space that's no longer in use doesn't have to
+// hold up the exiting (or exec'ing) process; hand it to the workqueue.
+// If the work item can't be allocated, just do it now.
+static void asDestroyWork(void* ptr) {
+  as_destroy((struct addrspace*) ptr);
+}
+static void asDestroyLater(struct addrspace* as) {
+  if (workqueue_schedule(asDestroyWork, as) != 0) {
+    as_destroy(as);
+  }
+}
+// A vfork child is done with its parent's address space (it has
+// exec'd or is exiting); let the parent carry on.
+static void vforkRelease(struct proc* p) {
+  struct semaphore* sem = p->p_vforkSem;
+
+  // the parent destroys the semaphore once it wakes
+  p->p_vforkSem = NULL;
+  V(sem);
+}
 // implementation of fork 
 
 pid_t sys_fork(struct trapframe* tf, pid_t* retval) {
@@ -38,13 +61,13 @@ pid_t sys_fork(struct trapframe* tf, pid_t* retval) {
   // address space 
   as_copy(curproc_getas(), &child->p_addrspace);
   if (child->p_addrspace == NULL) {
+    proc_destroy(child);
     return ENOMEM;
   }
 
-  // parent-child relationship 
-  lock_acquire(procLock);
-  allProcess[child->procPID].parentPID = curproc->procPID;
-  lock_release(procLock);
+  // parent-child relationship: the child goes on the parent's list
+  // so the parent's exit can find it
+  procAddChild(curproc, child);
 
   // trap frame 
   struct trapframe* temp = kmalloc(sizeof(struct trapframe));
@@ -71,21 +94,12 @@ void sys__exit(int exitcode) {
      an unused variable */
   #if OPT_A2
     if (p->procPID < PID_MIN) { return; }
-    lock_acquire(procLock);
-    allProcess[p->procPID].proc = NULL;
-    allProcess[p->procPID].exitCode = exitcode;
-    // wake up the parent process if it has one 
-    pid_t parent = allProcess[p->procPID].parentPID;
-    if (parent != -1 && allProcess[parent].proc != NULL) {
-      cv_signal(allProcess[p->procPID].procCV, procLock);
-    }
-    lock_release(procLock);
+    procExit(p, exitcode);
   #else
     (void)exitcode;
   #endif
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
-  KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -95,7 +109,13 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+  if (p->p_vforkSem != NULL) {
+    // borrowed from a vfork parent, who gets it back
+    vforkRelease(p);
+  } else if (as != NULL) {
+    // (a spawned child that failed to load has none)
+    asDestroyLater(as);
+  }
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -140,20 +160,22 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval) {
      Fix this!
   */
 
-  if (options != 0) { return(EINVAL); }
-  /* for now, just pretend the exitstatus is 0 */
   #if OPT_A2
-    lock_acquire(procLock);
-    if (allProcess[pid].parentPID != curproc->procPID) {
-      lock_release(procLock);
-      return ESRCH;
+    if ((options & ~WNOHANG) != 0) { return(EINVAL); }
+    int exitcode;
+    result = procWait(pid, (options & WNOHANG) != 0, &pid, &exitcode);
+    if (result) {
+      return result;
     }
-    while (allProcess[pid].proc != NULL) {
-      cv_wait(allProcess[pid].procCV, procLock);
+    // WNOHANG and no child has exited yet: nothing to report
+    if (pid == 0) {
+      *retval = 0;
+      return 0;
     }
-    exitstatus = _MKWAIT_EXIT(allProcess[pid].exitCode);
-    lock_release(procLock);
+    exitstatus = _MKWAIT_EXIT(exitcode);
   #else
+    if (options != 0) { return(EINVAL); }
+    /* for now, just pretend the exitstatus is 0 */
     exitstatus = 0;
   #endif
 
@@ -165,169 +187,374 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval) {
   return(0);
 }
 
-int sys_execv(const_userptr_t program, userptr_t args) {
-  //(void)program;
-  (void)args;
-	int result;
-  size_t actual; 
-
-  char** argv = NULL;
-  char** addressOfArgs = NULL;
-  char* pathAndArgv = kmalloc(PATH_MAX + ARG_MAX);
-  if (pathAndArgv == NULL) { return ENOMEM; }
-
-  // setting the position of path
-  char* path = pathAndArgv;
-  // setting the postion of arguments
-  char* arg = path + PATH_MAX;
-  // setting the last position 
-  char* end = path + PATH_MAX + ARG_MAX;
-
-  /* copy arguments into kernel*/
-  int argc = 0;
-  char* currPos = arg;
+// A program's path and arguments, copied into the kernel by
+// argsCopyin for execv or spawn.
+//
+// The arguments are packed in one pass into a block laid out exactly
+// as it goes on the new user stack: the strings, padded to a word,
+// then the argv pointers and padding to a doubleword. While the
+// strings are copied in, their offsets are kept at the far end of
+// the buffer; argsCopyout turns them into user pointers once the
+// stack address is known and copies the block out in one go.
+#define EXEC_BUFSIZE (PATH_MAX + ARG_MAX)
+struct execArgs {
+  char* buf;      // EXEC_BUFSIZE: path, then the block
+  char* path;
+  char* block;
+  size_t strsize; // bytes of strings, padding included
+  size_t size;    // bytes of the whole block
+  int argc;
+  int scratch;    // cpu whose scratch buffer buf is, or -1
+};
+
+// The buffers are big, and exec is common, so each cpu keeps one
+// around. A buffer belongs to whoever set busy, not to the cpu, so
+// it doesn't matter if we get moved elsewhere while using it; if the
+// one here is already taken, fall back to kmalloc.
+struct execScratch {
+  char* buf;
+  volatile uint32_t busy;
+};
+static PERCPU_DEFINE(struct execScratch, execScratch);
+
+static int argsBufGet(struct execArgs* ea) {
+  unsigned n = percpu_curnum();
+  struct execScratch* es = &PERCPU_CPU(execScratch, n);
+
+  if (atomic_swap(&es->busy, 1) == 0) {
+    membar_load_any();
+    if (es->buf == NULL) {
+      es->buf = kmalloc(EXEC_BUFSIZE);
+    }
+    if (es->buf != NULL) {
+      ea->buf = es->buf;
+      ea->scratch = n;
+      return 0;
+    }
+    membar_any_any();
+    es->busy = 0;
+  }
+  ea->buf = kmalloc(EXEC_BUFSIZE);
+  if (ea->buf == NULL) { return ENOMEM; }
+  ea->scratch = -1;
+  return 0;
+}
+
+static void argsFree(struct execArgs* ea) {
+  struct execScratch* es;
+
+  if (ea->scratch < 0) {
+    kfree(ea->buf);
+    return;
+  }
+  es = &PERCPU_CPU(execScratch, ea->scratch);
+  KASSERT(es->buf == ea->buf && es->busy);
+  membar_any_any();
+  es->busy = 0;
+}
+
+static int argsCopyin(const_userptr_t program, userptr_t args,
+                      struct execArgs* ea) {
+  int result;
+  size_t actual, room, reserve, pad;
+  userptr_t currArg;
+
+  result = argsBufGet(ea);
+  if (result) {
+    return result;
+  }
+  ea->path = ea->buf;
+  ea->block = ea->buf + PATH_MAX;
+
+  /* copy the program name*/
+  result = copyinstr(program, ea->path, PATH_MAX, &actual);
+  if (result != 0) {
+    argsFree(ea);
+    return result;
+  }
+
+  // strings go forward from the start of the block, their offsets
+  // backward from the end
+  char* end = ea->block + ARG_MAX;
+  char* pos = ea->block;
+  uint32_t* offsets = (uint32_t*) end;
+  ea->argc = 0;
 
   while (true) {
-    userptr_t currArg;
-    result = copyin(args + argc * sizeof(userptr_t), &currArg, sizeof(userptr_t));
+    result = copyin(args + ea->argc * sizeof(userptr_t), &currArg, sizeof(userptr_t));
     if (result != 0) {
-      kfree(pathAndArgv);
-      return EFAULT;
+      argsFree(ea);
+      return result;
     }
     // reaching NULL pointer 
     if (currArg == NULL) { break; }
-    result = copyinstr(currArg, currPos, end - currPos, &actual);
+
+    // keep room for this string's offset, the argv pointers and the
+    // padding, so they can't run into each other
+    room = end - pos;
+    reserve = (sizeof(userptr_t) + sizeof(uint32_t)) * (ea->argc + 1) +
+      2 * sizeof(userptr_t) + 8;
+    if (room <= reserve) {
+      argsFree(ea);
+      return E2BIG;
+    }
+    result = copyinstr(currArg, pos, room - reserve, &actual);
     if (result != 0) {
-      kfree(pathAndArgv);
-      return EFAULT;
+      argsFree(ea);
+      return result == ENAMETOOLONG ? E2BIG : result;
     }
-    argc += 1;
-    currPos += actual; 
+    *--offsets = pos - ea->block;
+    ea->argc += 1;
+    pos += actual;
   }
-  /* copy the program name*/
-  result = copyinstr(program, path, PATH_MAX, &actual);
-  if (result != 0) { 
-    kfree(pathAndArgv);
-    return EFAULT;
+
+  // zero the padding; it goes out to user space
+  ea->strsize = ROUNDUP(pos - ea->block, sizeof(userptr_t));
+  ea->size = ROUNDUP(ea->strsize + (ea->argc + 1) * sizeof(userptr_t), 8);
+  pad = ea->strsize - (pos - ea->block);
+  bzero(pos, pad);
+  pad = ea->size - ea->strsize - (ea->argc + 1) * sizeof(userptr_t);
+  bzero(ea->block + ea->size - pad, pad);
+  return 0;
+}
+
+// Fill in the argv pointers for a block going just below *stackptr
+// on the (current) user stack and copy it out. Leaves *stackptr at
+// the bottom of the block and *uargv pointing at argv.
+static int argsCopyout(struct execArgs* ea, vaddr_t* stackptr,
+                       userptr_t* uargv) {
+  vaddr_t top = *stackptr - ea->size;
+  uint32_t* offsets = (uint32_t*) (ea->block + ARG_MAX);
+  userptr_t* argv = (userptr_t*) (ea->block + ea->strsize);
+  int result;
+
+  for (int i = 0; i < ea->argc; i++) {
+    argv[i] = (userptr_t) (top + offsets[-1 - i]);
   }
-  
-  char* temp = arg;
-  argv = kmalloc(argc * sizeof(char*));
-  if (argv == NULL) {
-    kfree(pathAndArgv);
+  argv[ea->argc] = NULL;
+
+  result = copyout(ea->block, (userptr_t) top, ea->size);
+  if (result != 0) {
+    return result;
+  }
+  *stackptr = top;
+  *uargv = (userptr_t) (top + ea->strsize);
+  return 0;
+}
+
+// Load the program in EA into a new address space, make it the
+// current one and set up its stack with the arguments (argv in
+// *UARGV). The old
+// address space comes back in *OLDAS for the caller to dispose of;
+// on failure it is current again and the new one is gone.
+static int execLoad(struct execArgs* ea, struct addrspace** oldas,
+                    vaddr_t* entrypoint, vaddr_t* stackptr,
+                    userptr_t* uargv) {
+  int result;
+  struct addrspace *as;
+  struct vnode *v;
+
+  /* Open the file. */
+  result = vfs_open(ea->path, O_RDONLY, 0, &v);
+  if (result) {
+    return result;
+  }
+
+  /* Create a new address space. */
+  as = as_create();
+  if (as == NULL) {
+    vfs_close(v);
     return ENOMEM;
   }
 
-  // store C-style strings into argv 
-  for (int i = 0; i < argc; i++) {
-    argv[i] = temp;
-    int length = strlen(temp) + 1;
-    temp += length * sizeof(char);
+  /* Switch to it and activate it. */
+  *oldas = curproc_setas(as);
+  as_activate();
+
+  /* Load the executable. */
+  result = load_elf(v, entrypoint);
+
+  /* Done with the file now. */
+  vfs_close(v);
+
+  /* Define the user stack in the address space */
+  if (result == 0) {
+    result = as_define_stack(as, stackptr);
   }
+  if (result == 0) {
+    result = argsCopyout(ea, stackptr, uargv);
+  }
+  if (result) {
+    // back to the old address space, so the caller can still report
+    // the error to it
+    curproc_setas(*oldas);
+    as_activate();
+    as_destroy(as);
+    return result;
+  }
+  return 0;
+}
 
-  struct addrspace *as;
-	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-
-	/* Open the file. */
-	result = vfs_open(path, O_RDONLY, 0, &v);
-	if (result) {
-		return result;
-	}
-
-	/* We should be a new process. */
-	//KASSERT(curproc_getas() == NULL);
-
-	/* Create a new address space. */
-	as = as_create();
-	if (as ==NULL) {
-		vfs_close(v);
-    kfree(pathAndArgv);
-    kfree(argv);
-		return ENOMEM;
-	}
-
-	/* Switch to it and activate it. */
-	struct addrspace* oldAs = curproc_getas();
-	if (oldAs != NULL) { as_destroy(oldAs); }
-	
-	curproc_setas(as);
-	as_activate();
-
-	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-    kfree(pathAndArgv);
-    kfree(argv);
-		return result;
-	}
-
-	/* Done with the file now. */
-	vfs_close(v);
-
-	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
-	if (result) {
-    kfree(pathAndArgv);
-    kfree(argv);
-		/* p_addrspace will go away when curproc is destroyed */
-		return result;
-	}
-
-	// top of stack
-	int totalArgsLength = 0;
-	for (int i = 0; i < argc; i++) {
-		totalArgsLength += strlen(argv[i]); // Length of argument
-		totalArgsLength += 1; // for NULL 
-	}
-
-	totalArgsLength += (argc + 1) * sizeof(userptr_t); 
-	stackptr -= ROUNDUP(totalArgsLength, 8); // top of stack
-	vaddr_t top = stackptr; 
-	vaddr_t argStart = top + (argc + 1) * sizeof(userptr_t); // where to start store strings
-	
-  addressOfArgs = kmalloc((argc + 1) * sizeof(char*));
-	if (addressOfArgs == NULL) { 
-    kfree(pathAndArgv);
-    kfree(argv);
-    return ENOMEM; 
-  }
-	addressOfArgs[argc] = NULL;
-
-	for (int i = 0; i < argc; i++) {
-		size_t length = strlen(argv[i]) + 1;
-		result = copyoutstr(argv[i], (userptr_t)argStart, length, &actual);
-		if (result != 0) { 
-      kfree(pathAndArgv);
-      kfree(argv);
-			kfree(addressOfArgs);
-			return EFAULT; 
-		}
-		addressOfArgs[i] = (char*) argStart;
-		argStart += actual + 1;
-	} 
-
-	for (int i = 0; i <= argc; i++) {
-		result = copyout(&addressOfArgs[i], (userptr_t)stackptr, sizeof(userptr_t));
-		if (result != 0) {
-      kfree(pathAndArgv);
-      kfree(argv);
-			kfree(addressOfArgs);
-			return EFAULT;
-		}
-		stackptr += sizeof(userptr_t);
-	} 
-  kfree(pathAndArgv);
-  kfree(argv);
-  kfree(addressOfArgs);
-	stackptr = top;
-	/* Warp to user mode. */ 
-	enter_new_process(argc /*argc*/, (userptr_t) top /*userspace addr of argv*/,
-			  stackptr, entrypoint);
+int sys_execv(const_userptr_t program, userptr_t args) {
+  struct execArgs ea;
+  struct addrspace* oldAs;
+  vaddr_t entrypoint, stackptr;
+  userptr_t uargv;
+  int argc;
+  int result;
+
+  result = argsCopyin(program, args, &ea);
+  if (result) {
+    return result;
+  }
+  result = execLoad(&ea, &oldAs, &entrypoint, &stackptr, &uargv);
+  argc = ea.argc;
+  argsFree(&ea);
+  if (result) {
+    return result;
+  }
+
+  // a vfork child hands the address space back to its parent;
+  // otherwise it's garbage now
+  if (curproc->p_vforkSem != NULL) {
+    vforkRelease(curproc);
+  } else if (oldAs != NULL) {
+    asDestroyLater(oldAs);
+  }
+
+  /* Warp to user mode. */ 
+  enter_new_process(argc /*argc*/, uargv /*userspace addr of argv*/,
+                    stackptr, entrypoint);
 	
-	/* enter_new_process does not return. */
-	panic("enter_new_process returned\n");
-	return EINVAL;
+  /* enter_new_process does not return. */
+  panic("enter_new_process returned\n");
+  return EINVAL;
+}
+
+// vfork: like fork, but the child borrows our address space instead
+// of copying it, and we sleep until it execs or exits. Meanwhile the
+// child may only call execv or _exit.
+pid_t sys_vfork(struct trapframe* tf, pid_t* retval) {
+  int success;
+  pid_t pid;
+
+  struct proc* child = proc_create_runprogram(curproc->p_name);
+  if (child == NULL) {
+    return ENOMEM;
+  }
+  struct semaphore* sem = sem_create("vfork", 0);
+  if (sem == NULL) {
+    proc_destroy(child);
+    return ENOMEM;
+  }
+  child->p_addrspace = curproc_getas();
+  child->p_vforkSem = sem;
+  procAddChild(curproc, child);
+
+  struct trapframe* temp = kmalloc(sizeof(struct trapframe));
+  if (temp == NULL) {
+    success = ENOMEM;
+    goto fail;
+  }
+  *temp = *tf;
+  pid = child->procPID;
+  success = thread_fork(curthread->t_name, child, threadForkWrapper, temp, 0);
+  if (success != 0) {
+    kfree(temp);
+    goto fail;
+  }
+
+  P(sem);
+  sem_destroy(sem);
+  *retval = pid;
+  return 0;
+
+ fail:
+  // the address space is still ours
+  child->p_addrspace = NULL;
+  child->p_vforkSem = NULL;
+  proc_destroy(child);
+  sem_destroy(sem);
+  return success;
+}
+
+// What spawn's parent hands its child thread, and gets back.
+struct spawnArgs {
+  struct execArgs* ea;
+  struct proc* parent;
+  struct semaphore* done;
+  int result;
+};
+
+static void spawnEntry(void* ptr, unsigned long num) {
+  struct spawnArgs* sa = ptr;
+  struct addrspace* oldAs;
+  vaddr_t entrypoint, stackptr;
+  userptr_t uargv;
+  int argc = sa->ea->argc;
+  int result;
+  (void) num;
+
+  result = execLoad(sa->ea, &oldAs, &entrypoint, &stackptr, &uargv);
+  KASSERT(oldAs == NULL);
+  // only a child that's going to run becomes the parent's; one that
+  // failed to load exits parentless, so nobody has to reap it
+  if (result == 0) {
+    procAddChild(sa->parent, curproc);
+  }
+  sa->result = result;
+  // sa lives on the parent's stack; don't touch it after this
+  V(sa->done);
+
+  if (result) {
+    sys__exit(0);
+  }
+  enter_new_process(argc, uargv, stackptr, entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+// spawn: run a program in a new child process. The child's address
+// space is built straight from the executable, in the child's own
+// thread, so nothing of ours gets copied; we wait only until it has
+// loaded, to report any error.
+int sys_spawn(const_userptr_t program, userptr_t args, pid_t* retval) {
+  struct execArgs ea;
+  struct spawnArgs sa;
+  pid_t pid;
+  int result;
+
+  result = argsCopyin(program, args, &ea);
+  if (result) {
+    return result;
+  }
+  struct proc* child = proc_create_runprogram(ea.path);
+  if (child == NULL) {
+    argsFree(&ea);
+    return ENOMEM;
+  }
+  sa.ea = &ea;
+  sa.parent = curproc;
+  sa.result = 0;
+  sa.done = sem_create("spawn", 0);
+  if (sa.done == NULL) {
+    proc_destroy(child);
+    argsFree(&ea);
+    return ENOMEM;
+  }
+
+  pid = child->procPID;
+  result = thread_fork(child->p_name, child, spawnEntry, &sa, 0);
+  if (result) {
+    proc_destroy(child);
+  } else {
+    P(sa.done);
+    result = sa.result;
+  }
+  sem_destroy(sa.done);
+  argsFree(&ea);
+  if (result) {
+    return result;
+  }
+  *retval = pid;
+  return 0;
 }
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/sched.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <thread.h>
+#include <syscall.h>
+#include "opt-A2.h"
+
+/*
+ * Return scheduling statistics for the calling thread, along with the
+ * system load averages.
+ */
+int
+sys_sched_getstats(userptr_t user_stats)
+{
+	struct schedstats ss;
+
+	thread_getstats(curthread, &ss);
+	return copyout(&ss, user_stats, sizeof(ss));
+}
+
+/*
+ * Look up another process for the affinity calls. On success, returns
+ * with its table entry locked, which keeps the process from going
+ * away; sched_putproc unlocks it.
+ */
+static
+int
+sched_getproc(pid_t pid, struct proc **ret)
+{
+#if OPT_A2
+	procWrapper *entry;
+
+	entry = procLookup(pid);
+	if (entry == NULL) {
+		return ESRCH;
+	}
+	*ret = entry->proc;
+	return 0;
+#else
+	(void)pid;
+	(void)ret;
+	return ESRCH;
+#endif
+}
+
+static
+void
+sched_putproc(struct proc *p)
+{
+#if OPT_A2
+	procUnlock(p->procPID);
+#else
+	(void)p;
+#endif
+}
+
+/*
+ * Restrict the threads of process PID (0 for the caller) to the cpus
+ * in MASK.
+ *
+ * The current thread is done last, once nothing is locked, because
+ * thread_setaffinity may have to yield to move it.
+ */
+int
+sys_sched_setaffinity(pid_t pid, uint32_t mask)
+{
+	struct proc *p;
+	struct thread *t;
+	bool self;
+	unsigned i;
+	int result;
+
+#if OPT_A2
+	if (pid == curproc->procPID) {
+		pid = 0;
+	}
+#endif
+	if (pid == 0) {
+		/* We're running, so we can't go away. */
+		p = curproc;
+	}
+	else {
+		result = sched_getproc(pid, &p);
+		if (result) {
+			return result;
+		}
+	}
+
+	self = false;
+	result = 0;
+	spinlock_acquire(&p->p_lock);
+	for (i=0; i<threadarray_num(&p->p_threads) && result == 0; i++) {
+		t = threadarray_get(&p->p_threads, i);
+		if (t == curthread) {
+			self = true;
+		}
+		else {
+			result = thread_setaffinity(t, mask);
+		}
+	}
+	spinlock_release(&p->p_lock);
+	if (pid != 0) {
+		sched_putproc(p);
+	}
+
+	if (self && result == 0) {
+		result = thread_setaffinity(curthread, mask);
+	}
+	return result;
+}
+
+/*
+ * Return the affinity mask of process PID (0 for the caller).
+ */
+int
+sys_sched_getaffinity(pid_t pid, userptr_t user_mask)
+{
+	struct proc *p;
+	uint32_t mask;
+	int result;
+
+#if OPT_A2
+	if (pid == curproc->procPID) {
+		pid = 0;
+	}
+#endif
+	if (pid == 0) {
+		mask = thread_getaffinity(curthread);
+	}
+	else {
+		result = sched_getproc(pid, &p);
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&p->p_lock);
+		if (threadarray_num(&p->p_threads) > 0) {
+			mask = thread_getaffinity(
+				threadarray_get(&p->p_threads, 0));
+		}
+		else {
+			/* Exiting. */
+			mask = 0;
+		}
+		spinlock_release(&p->p_lock);
+		sched_putproc(p);
+	}
+
+	return copyout(&mask, user_mask, sizeof(mask));
+}
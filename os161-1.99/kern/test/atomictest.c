@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Atomic operations stress test.
+ *
+ * Two threads per cpu hammer the same few words with the atomic
+ * operations, and afterwards we check nothing was lost:
+ *
+ *   - everybody bumps one counter with atomic_inc and another with a
+ *     hand-rolled atomic_cas loop, and both must come out at the
+ *     total number of updates;
+ *   - everybody takes tickets with atomic_fetchadd, and every ticket
+ *     must have been handed out exactly once;
+ *   - everybody uses atomic_swap as a test-and-set lock around a
+ *     plain read-modify-write, which must not lose updates either;
+ *   - everybody counts a shared counter down with atomic_dec, and
+ *     exactly one of them must see it reach zero.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define ATOMITERS	2000	/* Updates of each kind per thread */
+#define ATOMINSIDE	10	/* Work inside the swap lock */
+#define ATOMMAXTHREADS	64
+
+static struct semaphore *atomdone;
+static volatile bool atomgo;
+static unsigned atomnthreads;
+
+static volatile uint32_t atomincs;
+static volatile uint32_t atomcases;
+static volatile uint32_t atomtickets;
+static volatile uint32_t atomswaplock;
+static volatile uint32_t atomlocked;
+static volatile uint32_t atomdown;
+static volatile uint32_t atomzeros;
+static volatile uint8_t *atomseen;
+
+static
+void
+atomthread(void *junk, unsigned long num)
+{
+	uint32_t old, ticket, v;
+	volatile unsigned j;
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	while (!atomgo) {
+		/* wait for everyone to be forked */
+	}
+
+	for (i=0; i<ATOMITERS; i++) {
+		atomic_inc(&atomincs);
+
+		old = atomcases;
+		while (1) {
+			v = atomic_cas(&atomcases, old, old + 1);
+			if (v == old) {
+				break;
+			}
+			old = v;
+		}
+
+		ticket = atomic_fetchadd(&atomtickets, 1);
+		KASSERT(ticket < atomnthreads * ATOMITERS);
+		atomseen[ticket]++;
+
+		while (atomic_swap(&atomswaplock, 1) != 0) {
+			/* spin */
+		}
+		membar_load_any();
+		v = atomlocked;
+		for (j=0; j<ATOMINSIDE; j++);
+		atomlocked = v + 1;
+		membar_store_store();
+		atomswaplock = 0;
+
+		if (atomic_dec(&atomdown) == 0) {
+			atomic_inc(&atomzeros);
+		}
+	}
+
+	V(atomdone);
+}
+
+int
+atomictest(int nargs, char **args)
+{
+	char tname[16];
+	unsigned i, total, dups;
+	uint64_t start, elapsed;
+	int result, failed;
+
+	(void)nargs;
+	(void)args;
+
+	atomnthreads = 2 * thread_numcpus();
+	if (atomnthreads > ATOMMAXTHREADS) {
+		atomnthreads = ATOMMAXTHREADS;
+	}
+	total = atomnthreads * ATOMITERS;
+
+	atomdone = sem_create("atomdone", 0);
+	if (atomdone == NULL) {
+		panic("atomictest: sem_create failed\n");
+	}
+	atomseen = kmalloc(total);
+	if (atomseen == NULL) {
+		panic("atomictest: Out of memory\n");
+	}
+	bzero((void *)atomseen, total);
+
+	atomgo = false;
+	atomincs = atomcases = atomtickets = 0;
+	atomswaplock = atomlocked = 0;
+	atomdown = total;
+	atomzeros = 0;
+
+	kprintf("Starting atomic operations test with %u threads...\n",
+		atomnthreads);
+
+	for (i=0; i<atomnthreads; i++) {
+		snprintf(tname, sizeof(tname), "atomtest%u", i);
+		result = thread_fork(tname, NULL, atomthread, NULL, i);
+		if (result) {
+			panic("atomictest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	start = gettime_nsecs();
+	atomgo = true;
+	for (i=0; i<atomnthreads; i++) {
+		P(atomdone);
+	}
+	elapsed = gettime_nsecs() - start;
+
+	failed = 0;
+	failed += testcheckval("atomictest", "atomic_inc counter",
+			       atomincs, total);
+	failed += testcheckval("atomictest", "atomic_cas counter",
+			       atomcases, total);
+	failed += testcheckval("atomictest", "tickets issued",
+			       atomtickets, total);
+	failed += testcheckval("atomictest", "swap-locked counter",
+			       atomlocked, total);
+	failed += testcheckval("atomictest", "atomic_dec counter",
+			       atomdown, 0);
+	failed += testcheckval("atomictest", "threads seeing zero",
+			       atomzeros, 1);
+
+	dups = 0;
+	for (i=0; i<total; i++) {
+		if (atomseen[i] != 1) {
+			dups++;
+		}
+	}
+	failed += testcheckval("atomictest", "tickets not issued once",
+			       dups, 0);
+
+	kfree((void *)atomseen);
+	sem_destroy(atomdone);
+
+	kprintf("atomictest: %u updates of each kind in %llu us\n",
+		total, elapsed / 1000);
+	if (failed) {
+		kprintf("Atomic operations test FAILED\n");
+	}
+	else {
+		kprintf("Atomic operations test done.\n");
+	}
+	return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Futex test.
+ *
+ * The userlevel futextest can only check the cases that don't sleep,
+ * since a process has just the one thread. Here kernel threads use a
+ * word in the kernel's direct-mapped memory, which sys_futex_wait and
+ * sys_futex_wake accept from kernel threads, to check the rest:
+ *
+ * FXWAITERS threads wait on the word while it is 0, plus one on a
+ * second word. Once they're all asleep the word is set to 1 and
+ * waking one must wake exactly one, and waking the rest the other
+ * FXWAITERS - 1; each must have actually slept rather than failed
+ * with EAGAIN. The thread on the second word must sleep through all
+ * that, and wake only when its own word is woken.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <syscall.h>
+#include <test.h>
+
+#define FXWAITERS	8
+
+static volatile int32_t *fxword;	/* What the waiters wait on */
+static volatile int32_t *fxother;	/* What the bystander waits on */
+static struct semaphore *fxready;	/* One V per thread about to wait */
+static struct semaphore *fxdone;	/* One V per thread woken */
+static volatile uint32_t fxwoken;	/* Waiters woken so far */
+static volatile uint32_t fxbad;		/* Waits that didn't sleep */
+
+static
+void
+fxwaiter(void *word, unsigned long junk)
+{
+	int result;
+
+	(void)junk;
+
+	V(fxready);
+	result = sys_futex_wait((userptr_t)word, 0);
+	if (result) {
+		kprintf("futextest: futex_wait: %s\n", strerror(result));
+		atomic_inc(&fxbad);
+	}
+	if (word == fxword) {
+		atomic_inc(&fxwoken);
+	}
+	V(fxdone);
+}
+
+/* Wake up to COUNT threads on WORD; complain unless WANT were woken. */
+static
+unsigned
+fxwake(volatile int32_t *word, int count, int32_t want)
+{
+	int32_t woken;
+	int result;
+
+	result = sys_futex_wake((userptr_t)word, count, &woken);
+	if (result) {
+		kprintf("futextest: futex_wake: %s\n", strerror(result));
+		return 1;
+	}
+	if (woken != want) {
+		kprintf("futextest: futex_wake woke %d, expected %d\n",
+			woken, want);
+		return 1;
+	}
+	return 0;
+}
+
+int
+futextest(int nargs, char **args)
+{
+	char tname[16];
+	unsigned i, bad;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	fxword = kmalloc(sizeof(*fxword));
+	fxother = kmalloc(sizeof(*fxother));
+	fxready = sem_create("fxready", 0);
+	fxdone = sem_create("fxdone", 0);
+	if (fxword == NULL || fxother == NULL ||
+	    fxready == NULL || fxdone == NULL) {
+		panic("futextest: Out of memory\n");
+	}
+	*fxword = 0;
+	*fxother = 0;
+	fxwoken = 0;
+	fxbad = 0;
+	bad = 0;
+
+	kprintf("Starting futex test...\n");
+
+	/* Nobody waiting yet, and a stale value doesn't sleep. */
+	bad += fxwake(fxword, FXWAITERS, 0);
+	result = sys_futex_wait((userptr_t)fxword, 1);
+	if (result != EAGAIN) {
+		kprintf("futextest: futex_wait on a changed word: %s\n",
+			strerror(result));
+		bad++;
+	}
+
+	for (i=0; i<=FXWAITERS; i++) {
+		snprintf(tname, sizeof(tname), "futextest%u", i);
+		result = thread_fork(tname, NULL, fxwaiter,
+				     (void *)(i < FXWAITERS ? fxword : fxother),
+				     0);
+		if (result) {
+			panic("futextest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<=FXWAITERS; i++) {
+		P(fxready);
+	}
+	/* give them all time to get to sleep */
+	clocksleep(1);
+
+	*fxword = 1;
+	bad += fxwake(fxword, 1, 1);
+	P(fxdone);
+	/* give a wrongly woken second waiter a chance to show up */
+	clocksleep(1);
+	if (fxwoken != 1) {
+		kprintf("futextest: waking one woke %u\n", fxwoken);
+		bad++;
+	}
+
+	bad += fxwake(fxword, FXWAITERS, FXWAITERS - 1);
+	for (i=1; i<FXWAITERS; i++) {
+		P(fxdone);
+	}
+	if (fxwoken != FXWAITERS) {
+		kprintf("futextest: %u of %u waiters woken\n", fxwoken,
+			FXWAITERS);
+		bad++;
+	}
+
+	/* The bystander should still be asleep on its own word. */
+	bad += fxwake(fxother, 1, 1);
+	P(fxdone);
+
+	if (fxbad > 0) {
+		kprintf("futextest: %u waits failed\n", fxbad);
+		bad++;
+	}
+
+	sem_destroy(fxdone);
+	sem_destroy(fxready);
+	kfree((void *)fxother);
+	kfree((void *)fxword);
+
+	if (bad > 0) {
+		kprintf("Futex test FAILED\n");
+	}
+	else {
+		kprintf("Futex test done.\n");
+	}
+	return 0;
+}
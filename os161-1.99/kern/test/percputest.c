@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-cpu counter test.
+ *
+ * Two threads per cpu add to a pair of per-cpu counters, one a step
+ * at a time and one in steps of three, and the totals must come out
+ * right however the threads were spread over (and moved between)
+ * cpus. The per-cpu parts must add up to the total, and zeroing must
+ * clear every cpu's part. For comparison, the same number of
+ * increments is also done with atomic_inc on one shared word.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <percpu.h>
+#include <platform/maxcpus.h>
+#include <test.h>
+
+#define PCPUITERS	5000	/* Updates of each kind per thread */
+#define PCPUMAXTHREADS	64
+
+static struct semaphore *pcpudone;
+static volatile bool pcpugo;
+static unsigned pcpunthreads;
+
+static struct pcpu_counter pcpuones = PCPU_COUNTER_INITIALIZER;
+static struct pcpu_counter pcputhrees = PCPU_COUNTER_INITIALIZER;
+static volatile uint32_t pcpushared;
+
+static
+void
+pcputhread(void *junk, unsigned long atomic)
+{
+	unsigned i;
+
+	(void)junk;
+
+	while (!pcpugo) {
+		/* wait for everyone to be forked */
+	}
+
+	for (i=0; i<PCPUITERS; i++) {
+		if (atomic) {
+			atomic_inc(&pcpushared);
+		}
+		else {
+			pcpu_counter_inc(&pcpuones);
+			pcpu_counter_add(&pcputhrees, 3);
+		}
+	}
+
+	V(pcpudone);
+}
+
+/*
+ * Run all the threads once, either with the per-cpu counters or
+ * with atomic_inc, and return how long it took in nanoseconds.
+ */
+static
+uint64_t
+pcpurun(bool atomic)
+{
+	char tname[16];
+	unsigned i;
+	uint64_t start;
+	int result;
+
+	pcpugo = false;
+	for (i=0; i<pcpunthreads; i++) {
+		snprintf(tname, sizeof(tname), "pcputest%u", i);
+		result = thread_fork(tname, NULL, pcputhread, NULL, atomic);
+		if (result) {
+			panic("percputest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	start = gettime_nsecs();
+	pcpugo = true;
+	for (i=0; i<pcpunthreads; i++) {
+		P(pcpudone);
+	}
+	return gettime_nsecs() - start;
+}
+
+int
+percputest(int nargs, char **args)
+{
+	unsigned i, total, sum, used;
+	uint64_t pcputime, atomictime;
+	int failed;
+
+	(void)nargs;
+	(void)args;
+
+	pcpunthreads = 2 * thread_numcpus();
+	if (pcpunthreads > PCPUMAXTHREADS) {
+		pcpunthreads = PCPUMAXTHREADS;
+	}
+	total = pcpunthreads * PCPUITERS;
+
+	pcpudone = sem_create("pcpudone", 0);
+	if (pcpudone == NULL) {
+		panic("percputest: sem_create failed\n");
+	}
+
+	pcpu_counter_zero(&pcpuones);
+	pcpu_counter_zero(&pcputhrees);
+	pcpushared = 0;
+
+	kprintf("Starting per-cpu counter test with %u threads...\n",
+		pcpunthreads);
+
+	pcputime = pcpurun(false);
+	atomictime = pcpurun(true);
+
+	failed = 0;
+	failed += testcheckval("percputest", "counter",
+			       pcpu_counter_read(&pcpuones), total);
+	failed += testcheckval("percputest", "counter by threes",
+			       pcpu_counter_read(&pcputhrees), 3 * total);
+	failed += testcheckval("percputest", "atomic counter",
+			       pcpushared, total);
+
+	sum = used = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		sum += pcpu_counter_readcpu(&pcpuones, i);
+		if (pcpu_counter_readcpu(&pcpuones, i) > 0) {
+			used++;
+		}
+	}
+	failed += testcheckval("percputest", "sum over cpus",
+			       sum, total);
+
+	pcpu_counter_zero(&pcpuones);
+	failed += testcheckval("percputest", "zeroed counter",
+			       pcpu_counter_read(&pcpuones), 0);
+
+	sem_destroy(pcpudone);
+
+	kprintf("percputest: counted on %u cpus\n", used);
+	kprintf("percputest: %u increments: per-cpu %llu us, atomic %llu us\n",
+		total, pcputime / 1000, atomictime / 1000);
+	if (failed) {
+		kprintf("Per-cpu counter test FAILED\n");
+	}
+	else {
+		kprintf("Per-cpu counter test done.\n");
+	}
+	return 0;
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Ring buffer test.
+ *
+ * First some single-threaded checks of the edges: a ring holds
+ * exactly its (rounded-up) size, enqueue on a full ring fails with
+ * ENOSPC, dequeue on an empty one returns NULL, and batches stop at
+ * the ends.
+ *
+ * Then the SPSC ring is run with one producer and one consumer
+ * thread, which must see every item in order; and the MPMC ring with
+ * a producer and a consumer per cpu, which between them must see
+ * every item exactly once. Both sides use batches of varying sizes.
+ * Whoever finds the ring full or empty yields, so this also works on
+ * one cpu.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <ring.h>
+#include <test.h>
+
+#define RINGSIZE	32	/* Small, so the ends get hit a lot */
+#define RINGITEMS	20000	/* Items per producer */
+#define RINGBATCH	7	/* Largest batch */
+#define RINGMAXPAIRS	16
+
+static struct semaphore *ringdone;
+static struct spscring *ringspsc;
+static struct mpmcring *ringmpmc;
+static unsigned ringpairs;
+static volatile uint8_t *ringseen;
+static volatile unsigned ringbad;
+
+/* Items are 1..N, cast to pointers, so none of them is NULL. */
+#define ITEM(n)		((void *)(uintptr_t)(n))
+#define ITEMNUM(p)	((unsigned)(uintptr_t)(p))
+
+static
+void
+spscproducer(void *junk, unsigned long junk2)
+{
+	void *batch[RINGBATCH];
+	unsigned next, n, i;
+
+	(void)junk;
+	(void)junk2;
+
+	next = 1;
+	while (next <= RINGITEMS) {
+		n = next % RINGBATCH + 1;
+		if (next + n > RINGITEMS + 1) {
+			n = RINGITEMS + 1 - next;
+		}
+		for (i=0; i<n; i++) {
+			batch[i] = ITEM(next + i);
+		}
+		n = spscring_enqueue_batch(ringspsc, batch, n);
+		if (n == 0) {
+			thread_yield();
+		}
+		next += n;
+	}
+	V(ringdone);
+}
+
+static
+void
+spscconsumer(void *junk, unsigned long junk2)
+{
+	void *batch[RINGBATCH];
+	unsigned expect, n, i;
+
+	(void)junk;
+	(void)junk2;
+
+	expect = 1;
+	while (expect <= RINGITEMS) {
+		n = spscring_dequeue_batch(ringspsc, batch,
+					   expect % RINGBATCH + 1);
+		if (n == 0) {
+			thread_yield();
+		}
+		for (i=0; i<n; i++) {
+			if (ITEMNUM(batch[i]) != expect) {
+				kprintf("ringtest: spsc got %u, expected %u\n",
+					ITEMNUM(batch[i]), expect);
+				ringbad++;
+			}
+			expect++;
+		}
+	}
+	V(ringdone);
+}
+
+static
+void
+mpmcproducer(void *junk, unsigned long num)
+{
+	void *batch[RINGBATCH];
+	unsigned next, last, n, i;
+
+	(void)junk;
+
+	/* Producer NUM sends items NUM*RINGITEMS+1 to (NUM+1)*RINGITEMS. */
+	next = num * RINGITEMS + 1;
+	last = (num + 1) * RINGITEMS;
+	while (next <= last) {
+		n = next % RINGBATCH + 1;
+		if (next + n > last + 1) {
+			n = last + 1 - next;
+		}
+		for (i=0; i<n; i++) {
+			batch[i] = ITEM(next + i);
+		}
+		n = mpmcring_enqueue_batch(ringmpmc, batch, n);
+		if (n == 0) {
+			thread_yield();
+		}
+		next += n;
+	}
+	V(ringdone);
+}
+
+static
+void
+mpmcconsumer(void *junk, unsigned long num)
+{
+	void *batch[RINGBATCH];
+	unsigned got, n, i;
+
+	(void)junk;
+
+	/* Every consumer takes the same number of items. */
+	got = 0;
+	while (got < RINGITEMS) {
+		n = (got + num) % RINGBATCH + 1;
+		if (n > RINGITEMS - got) {
+			n = RINGITEMS - got;
+		}
+		n = mpmcring_dequeue_batch(ringmpmc, batch, n);
+		if (n == 0) {
+			thread_yield();
+		}
+		for (i=0; i<n; i++) {
+			ringseen[ITEMNUM(batch[i]) - 1]++;
+		}
+		got += n;
+	}
+	V(ringdone);
+}
+
+/*
+ * Fill and drain an empty ring of each kind by hand.
+ */
+static
+void
+ringedges(void)
+{
+	void *batch[RINGSIZE + 1];
+	unsigned i, n;
+
+	for (i=0; i<RINGSIZE + 1; i++) {
+		batch[i] = ITEM(i + 1);
+	}
+
+	ringbad += testcheck("ringtest", "spsc dequeue from empty",
+			     spscring_dequeue(ringspsc) == NULL);
+	n = spscring_enqueue_batch(ringspsc, batch, RINGSIZE + 1);
+	ringbad += testcheck("ringtest", "spsc batch stops when full",
+			     n == RINGSIZE);
+	ringbad += testcheck("ringtest", "spsc enqueue when full",
+			     spscring_enqueue(ringspsc, ITEM(1)) == ENOSPC);
+	ringbad += testcheck("ringtest", "spsc first out",
+			     spscring_dequeue(ringspsc) == ITEM(1));
+	n = spscring_dequeue_batch(ringspsc, batch, RINGSIZE + 1);
+	ringbad += testcheck("ringtest", "spsc batch stops when empty",
+			     n == RINGSIZE - 1);
+	ringbad += testcheck("ringtest", "spsc batch order",
+			     batch[0] == ITEM(2) &&
+			     batch[n - 1] == ITEM(RINGSIZE));
+	ringbad += testcheck("ringtest", "spsc empty",
+			     spscring_empty(ringspsc));
+
+	for (i=0; i<RINGSIZE + 1; i++) {
+		batch[i] = ITEM(i + 1);
+	}
+
+	ringbad += testcheck("ringtest", "mpmc dequeue from empty",
+			     mpmcring_dequeue(ringmpmc) == NULL);
+	n = mpmcring_enqueue_batch(ringmpmc, batch, RINGSIZE + 1);
+	ringbad += testcheck("ringtest", "mpmc batch stops when full",
+			     n == RINGSIZE);
+	ringbad += testcheck("ringtest", "mpmc enqueue when full",
+			     mpmcring_enqueue(ringmpmc, ITEM(1)) == ENOSPC);
+	ringbad += testcheck("ringtest", "mpmc first out",
+			     mpmcring_dequeue(ringmpmc) == ITEM(1));
+	ringbad += testcheck("ringtest", "mpmc enqueue after dequeue",
+			     mpmcring_enqueue(ringmpmc,
+					      ITEM(RINGSIZE + 1)) == 0);
+	n = mpmcring_dequeue_batch(ringmpmc, batch, RINGSIZE + 1);
+	ringbad += testcheck("ringtest", "mpmc batch stops when empty",
+			     n == RINGSIZE);
+	ringbad += testcheck("ringtest", "mpmc batch order",
+			     batch[0] == ITEM(2) &&
+			     batch[n - 1] == ITEM(RINGSIZE + 1));
+	ringbad += testcheck("ringtest", "mpmc empty",
+			     mpmcring_empty(ringmpmc));
+}
+
+static
+void
+ringfork(const char *name, void (*func)(void *, unsigned long),
+	 unsigned long num)
+{
+	char tname[16];
+	int result;
+
+	snprintf(tname, sizeof(tname), "%s%lu", name, num);
+	result = thread_fork(tname, NULL, func, NULL, num);
+	if (result) {
+		panic("ringtest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+ringtest(int nargs, char **args)
+{
+	unsigned i, total, dups;
+	uint64_t start, spsctime, mpmctime;
+
+	(void)nargs;
+	(void)args;
+
+	ringpairs = thread_numcpus();
+	if (ringpairs > RINGMAXPAIRS) {
+		ringpairs = RINGMAXPAIRS;
+	}
+	total = ringpairs * RINGITEMS;
+
+	ringdone = sem_create("ringdone", 0);
+	ringspsc = spscring_create(RINGSIZE - 1);
+	ringmpmc = mpmcring_create(RINGSIZE);
+	ringseen = kmalloc(total);
+	if (ringdone == NULL || ringspsc == NULL || ringmpmc == NULL ||
+	    ringseen == NULL) {
+		panic("ringtest: Out of memory\n");
+	}
+	bzero((void *)ringseen, total);
+	ringbad = 0;
+
+	kprintf("Starting ring buffer test...\n");
+
+	ringedges();
+
+	start = gettime_nsecs();
+	ringfork("spscprod", spscproducer, 0);
+	ringfork("spsccons", spscconsumer, 0);
+	P(ringdone);
+	P(ringdone);
+	spsctime = gettime_nsecs() - start;
+	ringbad += testcheck("ringtest", "spsc empty at end",
+			     spscring_empty(ringspsc));
+
+	start = gettime_nsecs();
+	for (i=0; i<ringpairs; i++) {
+		ringfork("mpmcprod", mpmcproducer, i);
+		ringfork("mpmccons", mpmcconsumer, i);
+	}
+	for (i=0; i<2 * ringpairs; i++) {
+		P(ringdone);
+	}
+	mpmctime = gettime_nsecs() - start;
+	ringbad += testcheck("ringtest", "mpmc empty at end",
+			     mpmcring_empty(ringmpmc));
+
+	dups = 0;
+	for (i=0; i<total; i++) {
+		if (ringseen[i] != 1) {
+			dups++;
+		}
+	}
+	ringbad += testcheck("ringtest", "mpmc items not seen exactly once",
+			     dups == 0);
+
+	kfree((void *)ringseen);
+	mpmcring_destroy(ringmpmc);
+	spscring_destroy(ringspsc);
+	sem_destroy(ringdone);
+
+	kprintf("ringtest: spsc: %u items in %llu us\n",
+		RINGITEMS, spsctime / 1000);
+	kprintf("ringtest: mpmc: %u producers, %u consumers, "
+		"%u items in %llu us\n", ringpairs, ringpairs, total,
+		mpmctime / 1000);
+	if (ringbad) {
+		kprintf("Ring buffer test FAILED\n");
+	}
+	else {
+		kprintf("Ring buffer test done.\n");
+	}
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reader-writer lock tests.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NRWLOOPS      200
+#define NTHREADS      32
+#define NWRITERS      4		/* of NTHREADS, in the first test */
+
+static struct rwlock *testrw;
+static struct semaphore *donesem;
+static struct spinlock countlock = SPINLOCK_INITIALIZER;
+
+static volatile unsigned long testval1;
+static volatile unsigned long testval2;
+static volatile unsigned long testval3;
+static volatile unsigned nreaders;
+static volatile unsigned maxreaders;
+static volatile unsigned rwfailures;
+
+static
+void
+inititems(void)
+{
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+	nreaders = maxreaders = 0;
+	rwfailures = 0;
+}
+
+static
+void
+cleanitems(void)
+{
+	rwlock_destroy(testrw);
+	sem_destroy(donesem);
+}
+
+static
+void
+forkthreads(const char *what, unsigned count,
+	    void (*func)(void *, unsigned long))
+{
+	char name[16];
+	unsigned i;
+	int result;
+
+	for (i=0; i<count; i++) {
+		snprintf(name, sizeof(name), "%s%u", what, i);
+		result = thread_fork(name, NULL, func, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+static
+void
+report(const char *test)
+{
+	if (rwfailures > 0) {
+		kprintf("%s FAILED: %u inconsistencies\n", test, rwfailures);
+	}
+	else {
+		kprintf("%s done.\n", test);
+	}
+}
+
+/*
+ * Count readers in and out of the lock, remembering the most that
+ * were ever in at once.
+ */
+static
+void
+reader_in(void)
+{
+	spinlock_acquire(&countlock);
+	nreaders++;
+	if (nreaders > maxreaders) {
+		maxreaders = nreaders;
+	}
+	spinlock_release(&countlock);
+}
+
+static
+void
+reader_out(void)
+{
+	spinlock_acquire(&countlock);
+	nreaders--;
+	spinlock_release(&countlock);
+}
+
+/*
+ * Test 1: consistency. Writers set three values to the same thing
+ * one at a time, yielding in between; readers must never see them
+ * disagree, and nobody may be reading while a writer is in.
+ */
+static
+void
+rwconsistthread(void *junk, unsigned long num)
+{
+	unsigned long v1, v2, v3;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num < NWRITERS) {
+			rwlock_acquire_write(testrw);
+			if (nreaders != 0) {
+				rwfailures++;
+			}
+			testval1 = num * NRWLOOPS + i;
+			thread_yield();
+			testval2 = testval1;
+			thread_yield();
+			testval3 = testval1;
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			reader_in();
+			v1 = testval1;
+			thread_yield();
+			v2 = testval2;
+			v3 = testval3;
+			if (v1 != v2 || v2 != v3) {
+				rwfailures++;
+			}
+			reader_out();
+			rwlock_release_read(testrw);
+		}
+		thread_yield();
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock consistency test...\n");
+	forkthreads("rwconsist", NTHREADS, rwconsistthread);
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	report("Rwlock consistency test");
+	cleanitems();
+
+	return 0;
+}
+
+/*
+ * Test 2: sharing. Readers hold the lock across a sleep, so they
+ * should pile up inside it together.
+ */
+static
+void
+rwsharethread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrw);
+	reader_in();
+	clocknap(2);
+	reader_out();
+	rwlock_release_read(testrw);
+	V(donesem);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock sharing test...\n");
+	forkthreads("rwshare", NTHREADS, rwsharethread);
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	kprintf("At most %u of %u readers held the lock at once\n",
+		maxreaders, NTHREADS);
+	if (maxreaders < 2) {
+		rwfailures++;
+	}
+	report("Rwlock sharing test");
+	cleanitems();
+
+	return 0;
+}
+
+/*
+ * Test 3: writer preference. With a reader in, a writer queues up;
+ * readers that arrive after it must wait until it has been through.
+ * testval1 counts writers done; each late reader checks it.
+ */
+static
+void
+rwprefwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_write(testrw);
+	testval1++;
+	rwlock_release_write(testrw);
+	V(donesem);
+}
+
+static
+void
+rwprefreader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrw);
+	if (testval1 == 0) {
+		rwfailures++;
+	}
+	rwlock_release_read(testrw);
+	V(donesem);
+}
+
+int
+rwtest3(int nargs, char **args)
+{
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock writer preference test...\n");
+
+	rwlock_acquire_read(testrw);
+	forkthreads("rwprefw", 1, rwprefwriter);
+	while (testrw->rw_waitwriters == 0) {
+		thread_yield();
+	}
+	forkthreads("rwprefr", NTHREADS - 1, rwprefreader);
+	/* give the readers a chance to (wrongly) get in */
+	clocknap(2);
+	rwlock_release_read(testrw);
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	report("Rwlock writer preference test");
+	cleanitems();
+
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock stress test and benchmark.
+ *
+ * One thread per cpu hammers a single lock until a fixed number of
+ * acquires have been made between them, once with the kernel's
+ * ticket spinlock and once with a plain test-and-test-and-set lock
+ * for comparison. Each critical section does an unlocked
+ * read-modify-write of a counter, so a broken lock shows up as lost
+ * updates. The report gives the time taken and the fewest and most
+ * acquires any one thread got, which shows how fair the lock is.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <platform/maxcpus.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SPINTOTAL	20000	/* Acquires per run, over all threads */
+#define SPININSIDE	20	/* Work inside the critical section */
+#define SPINOUTSIDE	50	/* Work between acquires */
+
+static struct spinlock testspin = SPINLOCK_INITIALIZER;
+static volatile spinlock_data_t testttas = SPINLOCK_DATA_INITIALIZER;
+static bool spinuseticket;
+
+static struct semaphore *spindone;
+static volatile bool spingo;
+static volatile bool spinstop;
+static volatile unsigned spincounter;
+static volatile unsigned spinacquires[MAXCPUS];
+
+/*
+ * The old spinlock algorithm, minus the bookkeeping.
+ */
+static
+void
+ttas_acquire(volatile spinlock_data_t *sd)
+{
+	while (1) {
+		if (spinlock_data_get(sd) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(sd) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+static
+void
+ttas_release(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+}
+
+static
+void
+spinthread(void *junk, unsigned long num)
+{
+	volatile unsigned j;
+	unsigned v, mine = 0;
+	int spl;
+
+	(void)junk;
+
+	while (!spingo) {
+		/* wait for everyone to be forked */
+	}
+
+	while (!spinstop) {
+		if (spinuseticket) {
+			spinlock_acquire(&testspin);
+		}
+		else {
+			spl = splhigh();
+			ttas_acquire(&testttas);
+		}
+
+		v = spincounter;
+		for (j=0; j<SPININSIDE; j++);
+		spincounter = v + 1;
+		if (spincounter >= SPINTOTAL) {
+			spinstop = true;
+		}
+		mine++;
+
+		if (spinuseticket) {
+			spinlock_release(&testspin);
+		}
+		else {
+			ttas_release(&testttas);
+			splx(spl);
+		}
+
+		for (j=0; j<SPINOUTSIDE; j++);
+	}
+
+	spinacquires[num] = mine;
+	V(spindone);
+}
+
+static
+int
+spinrun(const char *name, bool ticket, unsigned nthreads)
+{
+	char tname[16];
+	unsigned i, total, least, most;
+	uint64_t start, elapsed;
+	int result;
+
+	spinuseticket = ticket;
+	spingo = false;
+	spinstop = false;
+	spincounter = 0;
+
+	for (i=0; i<nthreads; i++) {
+		spinacquires[i] = 0;
+		snprintf(tname, sizeof(tname), "spintest%u", i);
+		result = thread_fork(tname, NULL, spinthread, NULL, i);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	start = gettime_nsecs();
+	spingo = true;
+	for (i=0; i<nthreads; i++) {
+		P(spindone);
+	}
+	elapsed = gettime_nsecs() - start;
+
+	total = 0;
+	least = most = spinacquires[0];
+	for (i=0; i<nthreads; i++) {
+		total += spinacquires[i];
+		if (spinacquires[i] < least) {
+			least = spinacquires[i];
+		}
+		if (spinacquires[i] > most) {
+			most = spinacquires[i];
+		}
+	}
+
+	kprintf("%s: %u acquires in %llu us; per thread %u to %u\n",
+		name, total, elapsed / 1000, least, most);
+	if (total != spincounter) {
+		kprintf("%s: FAILED: counter is %u, lost %u updates\n",
+			name, spincounter, total - spincounter);
+		return 1;
+	}
+	return 0;
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	unsigned nthreads;
+	int failed;
+
+	(void)nargs;
+	(void)args;
+
+	spindone = sem_create("spindone", 0);
+	if (spindone == NULL) {
+		panic("spinlocktest: sem_create failed\n");
+	}
+
+	nthreads = thread_numcpus();
+	kprintf("Starting spinlock test with %u threads...\n", nthreads);
+
+	failed = spinrun("ticket spinlock", true, nthreads);
+	failed += spinrun("test-and-set   ", false, nthreads);
+
+	sem_destroy(spindone);
+	if (failed) {
+		kprintf("Spinlock test FAILED\n");
+	}
+	else {
+		kprintf("Spinlock test done.\n");
+	}
+	return 0;
+}
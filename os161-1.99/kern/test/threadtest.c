@@ -32,6 +32,8 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
+#include <current.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -144,3 +146,88 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Affinity test. Each thread pins itself to one cpu, then spins and
+ * yields for a while. thread_setaffinity moves it there at once, even
+ * if that leaves the cpu it was on idle, so it should be on its cpu
+ * from the first round and never be seen anywhere else.
+ */
+
+#define AFFINITY_ROUNDS 200
+
+static volatile unsigned affinity_lost;
+static volatile unsigned affinity_strays;
+
+static
+void
+affinitythread(void *junk, unsigned long num)
+{
+	unsigned cpu = num % thread_numcpus();
+	bool arrived = false;
+	volatile int j;
+	int i, result;
+
+	(void)junk;
+
+	result = thread_setaffinity(curthread, (uint32_t)1 << cpu);
+	if (result) {
+		panic("threadtest: thread_setaffinity failed %s\n",
+		      strerror(result));
+	}
+
+	for (i=0; i<AFFINITY_ROUNDS; i++) {
+		if (curcpu->c_number == cpu) {
+			arrived = true;
+		}
+		else if (arrived) {
+			affinity_strays++;
+		}
+		for (j=0; j<2000; j++);
+		thread_yield();
+	}
+	if (!arrived) {
+		affinity_lost++;
+	}
+
+	V(tsem);
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	char name[16];
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting thread affinity test on %u cpus...\n",
+		thread_numcpus());
+	affinity_lost = 0;
+	affinity_strays = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		snprintf(name, sizeof(name), "affinity%d", i);
+		result = thread_fork(name, NULL, affinitythread, NULL, i);
+		if (result) {
+			panic("threadtest: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(tsem);
+	}
+
+	if (affinity_lost > 0 || affinity_strays > 0) {
+		kprintf("Thread affinity test FAILED: %u threads never "
+			"reached their cpu, %u rounds on the wrong one\n",
+			affinity_lost, affinity_strays);
+	}
+	else {
+		kprintf("Thread affinity test done.\n");
+	}
+
+	return 0;
+}
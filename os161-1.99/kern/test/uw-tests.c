@@ -162,6 +162,7 @@ uwlocktest1(int nargs, char **args)
   }
 	KASSERT(test_value == START_VALUE);
 
+	lock_printstats(testlock);
 	cleanitems();
 	kprintf("uwlocktest1 done.\n");
 
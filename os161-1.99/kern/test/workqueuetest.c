@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Workqueue test.
+ *
+ * One thread per cpu schedules a pile of work items with
+ * workqueue_schedule; every item must run exactly once, and the main
+ * thread waits for all of them. Then a caller-supplied work item is
+ * added many times with interrupts off, so the worker can't get to
+ * it in between; it must run only once.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <clock.h>
+#include <spl.h>
+#include <thread.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQITEMS		500	/* Items scheduled per thread */
+#define WQREPEATS	50	/* Adds of the same item */
+#define WQMAXTHREADS	32
+
+static struct semaphore *wqdone;	/* One V per work item run */
+static struct semaphore *wqforked;	/* One V per scheduling thread */
+static unsigned wqnthreads;
+static volatile uint8_t *wqseen;
+static volatile uint32_t wqruns;
+
+static
+void
+wqitem(void *arg)
+{
+	wqseen[(uintptr_t)arg]++;
+	atomic_inc(&wqruns);
+	V(wqdone);
+}
+
+static
+void
+wqthread(void *junk, unsigned long num)
+{
+	unsigned i;
+	int result;
+
+	(void)junk;
+
+	for (i=0; i<WQITEMS; i++) {
+		result = workqueue_schedule(wqitem,
+					    (void *)(uintptr_t)(num * WQITEMS + i));
+		if (result) {
+			panic("workqueuetest: workqueue_schedule: %s\n",
+			      strerror(result));
+		}
+	}
+	V(wqforked);
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	char tname[16];
+	struct work w;
+	unsigned i, total, bad;
+	uint64_t start, elapsed;
+	int result, spl;
+
+	(void)nargs;
+	(void)args;
+
+	wqnthreads = thread_numcpus();
+	if (wqnthreads > WQMAXTHREADS) {
+		wqnthreads = WQMAXTHREADS;
+	}
+	total = wqnthreads * WQITEMS;
+
+	wqdone = sem_create("wqdone", 0);
+	wqforked = sem_create("wqforked", 0);
+	wqseen = kmalloc(total);
+	if (wqdone == NULL || wqforked == NULL || wqseen == NULL) {
+		panic("workqueuetest: Out of memory\n");
+	}
+	bzero((void *)wqseen, total);
+	wqruns = 0;
+
+	kprintf("Starting workqueue test...\n");
+
+	start = gettime_nsecs();
+	for (i=0; i<wqnthreads; i++) {
+		snprintf(tname, sizeof(tname), "wqtest%u", i);
+		result = thread_fork(tname, NULL, wqthread, NULL, i);
+		if (result) {
+			panic("workqueuetest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<wqnthreads; i++) {
+		P(wqforked);
+	}
+	for (i=0; i<total; i++) {
+		P(wqdone);
+	}
+	elapsed = gettime_nsecs() - start;
+
+	bad = 0;
+	for (i=0; i<total; i++) {
+		if (wqseen[i] != 1) {
+			bad++;
+		}
+	}
+	if (bad > 0) {
+		kprintf("workqueuetest: FAILED: %u items not run once\n", bad);
+	}
+	kprintf("workqueuetest: %u items in %llu us\n", total,
+		elapsed / 1000);
+
+	/* Now the same item over and over; it should only run once. */
+	wqseen[0] = 0;
+	wqruns = 0;
+	work_init(&w, wqitem, (void *)(uintptr_t)0);
+	spl = splhigh();
+	for (i=0; i<WQREPEATS; i++) {
+		workqueue_add(&w);
+	}
+	splx(spl);
+	P(wqdone);
+	/* give a wrongly duplicated run a chance to show up */
+	clocksleep(1);
+	if (wqruns != 1) {
+		kprintf("workqueuetest: FAILED: repeated item ran %u times\n",
+			wqruns);
+		bad++;
+	}
+
+	kfree((void *)wqseen);
+	sem_destroy(wqforked);
+	sem_destroy(wqdone);
+
+	if (bad > 0) {
+		kprintf("Workqueue test FAILED\n");
+	}
+	else {
+		kprintf("Workqueue test done.\n");
+	}
+	return 0;
+}
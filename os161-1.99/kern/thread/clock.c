@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
@@ -39,9 +40,9 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Timed sleeps are kept on a hierarchical timing wheel driven by
+ * timerclock, so each tick only touches the sleepers that are due
+ * (plus an occasional cascade) rather than waking everybody to check.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,45 +52,91 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	20	/* Look for starving threads every 20 hardclocks. */
+#define LOADAVG_TICKS		(LOADAVG_INTERVAL * TIMER_HZ)
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Timer ticks per second. timerclock runs once every LT_GRANULARITY usec.
  */
-static struct wchan *lbolt;
+#define TIMER_HZ	(1000000 / LT_GRANULARITY)
+
 /*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * The timing wheel.
+ *
+ * Level L has TW_SLOTS slots, each covering TW_SLOTS^L ticks, so
+ * level 0 holds everything due within the next TW_SLOTS ticks, level
+ * 1 everything within TW_SLOTS^2, and so on. A sleeper goes in the
+ * lowest level whose range covers its deadline. When the ticks
+ * counter rolls over a level boundary, the slot at the next level up
+ * that has just come due is emptied and its threads are reinserted
+ * lower down ("cascading"); the level 0 slot for the current tick is
+ * then emptied and its threads woken.
+ *
+ * Deadlines further out than the whole wheel covers (about 43
+ * minutes at the default granularity) are parked in the last slot of
+ * the top level that comes due and cascade back into the same place
+ * until they get close enough.
+ *
+ * Each slot is a singly linked list through t_timernext. Everybody
+ * sleeps on the one wait channel, and timerclock wakes each expired
+ * thread individually with wchan_wakethread.
+ *
+ * Lock ordering: timerwheel_lock, then the timer wchan's lock.
  */
-static struct wchan *minibolt;
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	3
+#define TW_SPAN(level)	((uint32_t)1 << (TW_BITS * (level)))
 
-/* 
- * number of minibolts per second
- */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static struct spinlock timerwheel_lock = SPINLOCK_INITIALIZER;
+static struct thread *timerwheel[TW_LEVELS][TW_SLOTS];
+static uint32_t timerticks;		/* Ticks since boot; wraps */
+static struct wchan *timerchan;
 
 /*
- * minibolt countdown
+ * Setup.
  */
-static int minicount;
+void
+hardclock_bootstrap(void)
+{
+	timerchan = wchan_create("timer");
+	if (timerchan == NULL) {
+		panic("Couldn't create timer wchan\n");
+	}
+	/* we assume TIMER_HZ > 0 */
+	KASSERT(TIMER_HZ > 0);
+
+	spinlock_register(&timerwheel_lock, "timerwheel");
+}
 
 /*
- * Setup.
+ * Put T on the wheel according to its deadline. Deadlines that are
+ * already due go in the current tick's slot.
  */
+static
 void
-hardclock_bootstrap(void)
+timerwheel_insert(struct thread *t)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	uint32_t delta, when;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&timerwheel_lock));
+
+	delta = t->t_wakeup - timerticks;
+	when = t->t_wakeup;
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < TW_SPAN(level + 1)) {
+			break;
+		}
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	if (delta >= TW_SPAN(TW_LEVELS)) {
+		/* Too far out; park it where it'll come back around. */
+		when = timerticks + TW_SPAN(TW_LEVELS) - 1;
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+
+	t->t_timernext = timerwheel[level][(when >> (TW_BITS * level)) & TW_MASK];
+	timerwheel[level][(when >> (TW_BITS * level)) & TW_MASK] = t;
 }
 
 /*
@@ -99,12 +146,42 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct thread *t, *next;
+	unsigned level, slot;
+	uint32_t now;
+
+	spinlock_acquire(&timerwheel_lock);
+	now = ++timerticks;
+
+	/* Cascade, top level first, so entries can fall all the way down. */
+	for (level = TW_LEVELS - 1; level > 0; level--) {
+		if ((timerticks & (TW_SPAN(level) - 1)) != 0) {
+			continue;
+		}
+		slot = (timerticks >> (TW_BITS * level)) & TW_MASK;
+		t = timerwheel[level][slot];
+		timerwheel[level][slot] = NULL;
+		for (; t != NULL; t = next) {
+			next = t->t_timernext;
+			timerwheel_insert(t);
+		}
+	}
+
+	/* Wake whoever is due now. */
+	slot = timerticks & TW_MASK;
+	t = timerwheel[0][slot];
+	timerwheel[0][slot] = NULL;
+	for (; t != NULL; t = next) {
+		next = t->t_timernext;
+		KASSERT(t->t_wakeup == timerticks);
+		t->t_timernext = NULL;
+		wchan_wakethread(timerchan, t);
+	}
+
+	spinlock_release(&timerwheel_lock);
+
+	if (now % LOADAVG_TICKS == 0) {
+		thread_loadavg_update();
 	}
 }
 
@@ -123,10 +200,32 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	thread_consider_preemption();
+}
+
+/*
+ * Suspend execution until TICKS timer ticks from now.
+ */
+static
+void
+timer_sleep(uint32_t ticks)
+{
+	struct thread *cur = curthread;
+
+	if (ticks == 0) {
+		return;
 	}
-	thread_yield();
+
+	spinlock_acquire(&timerwheel_lock);
+	cur->t_wakeup = timerticks + ticks;
+	timerwheel_insert(cur);
+	/*
+	 * Lock the wchan before letting go of the wheel, so timerclock
+	 * can't try to wake us until we're actually asleep.
+	 */
+	wchan_lock(timerchan);
+	spinlock_release(&timerwheel_lock);
+	wchan_sleep(timerchan);
 }
 
 /*
@@ -135,11 +234,9 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		clocknanosleep(num_secs, 0);
+	}
 }
 
 /*
@@ -149,9 +246,32 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks > 0) {
+		timer_sleep(num_ticks);
+	}
+}
+
+/*
+ * Suspend execution for at least SECS seconds plus NSECS nanoseconds,
+ * rounded up to whole timer ticks. The tick in progress is already
+ * partly over, so it doesn't count. Sleeps longer than the tick
+ * counter can express are clamped to half its range (several months).
+ */
+void
+clocknanosleep(time_t secs, uint32_t nsecs)
+{
+	uint64_t ticks;
+
+	KASSERT(secs >= 0);
+	KASSERT(nsecs < 1000000000);
+
+	ticks = (uint64_t)secs * TIMER_HZ +
+		DIVROUNDUP(nsecs, LT_GRANULARITY * 1000);
+	if (ticks > 0) {
+		ticks++;
+	}
+	if (ticks > 0x7fffffff) {
+		ticks = 0x7fffffff;
+	}
+	timer_sleep(ticks);
 }
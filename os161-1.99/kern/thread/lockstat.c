@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lockstat profiler: a registry of every lock, CV and named spinlock,
+ * and a report of their contention summed by name.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <lockstat.h>
+
+/* Most distinct names (of each kind) the report can tell apart. */
+#define LOCKSTAT_MAXCLASSES	128
+
+/* Names are truncated to this in the report. */
+#define LOCKSTAT_NAMELEN	19
+
+/*
+ * Statistics for all the objects of one kind with the same name.
+ */
+struct lockstat_class {
+	char lsc_name[LOCKSTAT_NAMELEN];
+	unsigned lsc_kind;
+	unsigned lsc_count;		/* Live objects */
+	struct lockstats lsc_stats;
+};
+
+/*
+ * The registry. Live objects are on lockstat_list; the statistics of
+ * objects that have been destroyed are kept in lockstat_retired.
+ * Lock order: lockstat_lock before a lock's internal spinlock.
+ * Nothing is ever registered while holding lockstat_lock, and the
+ * lock itself isn't registered.
+ */
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+static struct lockstat_entry *lockstat_list;
+static struct lockstat_class lockstat_retired[LOCKSTAT_MAXCLASSES];
+static unsigned lockstat_nretired;
+static unsigned lockstat_dropped;
+
+static const char lockstat_kinds[] = "LCS";
+
+/*
+ * Add the numbers in FROM to TO.
+ */
+static
+void
+lockstats_add(struct lockstats *to, const struct lockstats *from)
+{
+	to->ls_acquires += from->ls_acquires;
+	to->ls_contended += from->ls_contended;
+	to->ls_spun += from->ls_spun;
+	to->ls_slept += from->ls_slept;
+	to->ls_waitns += from->ls_waitns;
+	if (from->ls_maxwaitns > to->ls_maxwaitns) {
+		to->ls_maxwaitns = from->ls_maxwaitns;
+	}
+	to->ls_holdns += from->ls_holdns;
+	if (from->ls_maxholdns > to->ls_maxholdns) {
+		to->ls_maxholdns = from->ls_maxholdns;
+	}
+	to->ls_spins += from->ls_spins;
+}
+
+/*
+ * Find the class for KIND and NAME in TABLE, adding it if there's
+ * room. Returns NULL if the table is full.
+ */
+static
+struct lockstat_class *
+lockstat_findclass(struct lockstat_class *table, unsigned *num,
+		   unsigned kind, const char *name)
+{
+	char shortname[LOCKSTAT_NAMELEN];
+	unsigned i;
+
+	snprintf(shortname, sizeof(shortname), "%s", name);
+	for (i=0; i<*num; i++) {
+		if (table[i].lsc_kind == kind &&
+		    !strcmp(table[i].lsc_name, shortname)) {
+			return &table[i];
+		}
+	}
+	if (*num == LOCKSTAT_MAXCLASSES) {
+		return NULL;
+	}
+	(*num)++;
+	bzero(&table[i], sizeof(table[i]));
+	strcpy(table[i].lsc_name, shortname);
+	table[i].lsc_kind = kind;
+	return &table[i];
+}
+
+/*
+ * Get the current statistics of a registered object. Called with
+ * lockstat_lock held.
+ */
+static
+void
+lockstat_get(struct lockstat_entry *lse, struct lockstats *ls)
+{
+	switch (lse->lse_kind) {
+	    case LOCKSTAT_LOCK:
+		lock_getstats(lse->lse_obj, ls);
+		break;
+	    case LOCKSTAT_CV:
+		cv_getstats(lse->lse_obj, ls);
+		break;
+	    case LOCKSTAT_SPIN:
+		spinlock_getstats(lse->lse_obj, ls);
+		break;
+	    default:
+		panic("lockstat: bad kind %u\n", lse->lse_kind);
+	}
+}
+
+void
+lockstat_register(struct lockstat_entry *lse, unsigned kind,
+		  const char *name, void *obj)
+{
+	KASSERT(kind < sizeof(lockstat_kinds) - 1);
+
+	lse->lse_kind = kind;
+	lse->lse_name = name;
+	lse->lse_obj = obj;
+
+	spinlock_acquire(&lockstat_lock);
+	lse->lse_prev = NULL;
+	lse->lse_next = lockstat_list;
+	if (lockstat_list != NULL) {
+		lockstat_list->lse_prev = lse;
+	}
+	lockstat_list = lse;
+	spinlock_release(&lockstat_lock);
+}
+
+void
+lockstat_unregister(struct lockstat_entry *lse, const struct lockstats *final)
+{
+	struct lockstat_class *lsc;
+
+	spinlock_acquire(&lockstat_lock);
+	if (lse->lse_prev != NULL) {
+		lse->lse_prev->lse_next = lse->lse_next;
+	}
+	else {
+		KASSERT(lockstat_list == lse);
+		lockstat_list = lse->lse_next;
+	}
+	if (lse->lse_next != NULL) {
+		lse->lse_next->lse_prev = lse->lse_prev;
+	}
+	lse->lse_prev = lse->lse_next = NULL;
+
+	if (final->ls_acquires > 0) {
+		lsc = lockstat_findclass(lockstat_retired, &lockstat_nretired,
+					 lse->lse_kind, lse->lse_name);
+		if (lsc != NULL) {
+			lockstats_add(&lsc->lsc_stats, final);
+		}
+		else {
+			lockstat_dropped++;
+		}
+	}
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Order for the report: most contended first, then longest waits,
+ * then most spinning.
+ */
+static
+bool
+lockstat_before(const struct lockstat_class *a, const struct lockstat_class *b)
+{
+	if (a->lsc_stats.ls_contended != b->lsc_stats.ls_contended) {
+		return a->lsc_stats.ls_contended > b->lsc_stats.ls_contended;
+	}
+	if (a->lsc_stats.ls_waitns != b->lsc_stats.ls_waitns) {
+		return a->lsc_stats.ls_waitns > b->lsc_stats.ls_waitns;
+	}
+	return a->lsc_stats.ls_spins > b->lsc_stats.ls_spins;
+}
+
+void
+lockstat_report(void)
+{
+	struct lockstat_class *table, tmp, *lsc;
+	struct lockstat_entry *lse;
+	struct lockstats ls;
+	unsigned num, dropped, i, j;
+
+	/* Can't kmalloc or kprintf with lockstat_lock held. */
+	table = kmalloc(LOCKSTAT_MAXCLASSES * sizeof(*table));
+	if (table == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	spinlock_acquire(&lockstat_lock);
+	num = lockstat_nretired;
+	memcpy(table, lockstat_retired, num * sizeof(*table));
+	dropped = lockstat_dropped;
+	for (lse = lockstat_list; lse != NULL; lse = lse->lse_next) {
+		lsc = lockstat_findclass(table, &num, lse->lse_kind,
+					 lse->lse_name);
+		if (lsc == NULL) {
+			dropped++;
+			continue;
+		}
+		lockstat_get(lse, &ls);
+		lockstats_add(&lsc->lsc_stats, &ls);
+		lsc->lsc_count++;
+	}
+	spinlock_release(&lockstat_lock);
+
+	/* Insertion sort; there aren't many. */
+	for (i=1; i<num; i++) {
+		tmp = table[i];
+		for (j=i; j>0 && lockstat_before(&tmp, &table[j-1]); j--) {
+			table[j] = table[j-1];
+		}
+		table[j] = tmp;
+	}
+
+	kprintf("K name                 n      acq "
+		"contend  wait(us) max(us)  hold(us)    spins\n");
+	for (i=0; i<num; i++) {
+		lsc = &table[i];
+		if (lsc->lsc_stats.ls_acquires == 0) {
+			continue;
+		}
+		kprintf("%c %-18s %3u %8u %7u %9llu %7llu %9llu %8llu\n",
+			lockstat_kinds[lsc->lsc_kind], lsc->lsc_name,
+			lsc->lsc_count,
+			lsc->lsc_stats.ls_acquires,
+			lsc->lsc_stats.ls_contended,
+			lsc->lsc_stats.ls_waitns / 1000,
+			lsc->lsc_stats.ls_maxwaitns / 1000,
+			lsc->lsc_stats.ls_holdns / 1000,
+			lsc->lsc_stats.ls_spins);
+	}
+	if (dropped > 0) {
+		kprintf("(%u objects not shown; too many names)\n", dropped);
+	}
+	kprintf("K: L = lock, C = cv (acq = waits), S = spinlock; "
+		"n = live objects\n");
+
+	kfree(table);
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat_entry *lse;
+	struct lock *lock;
+	struct cv *cv;
+	struct spinlock *splk;
+
+	spinlock_acquire(&lockstat_lock);
+	lockstat_nretired = 0;
+	lockstat_dropped = 0;
+	for (lse = lockstat_list; lse != NULL; lse = lse->lse_next) {
+		switch (lse->lse_kind) {
+		    case LOCKSTAT_LOCK:
+			lock = lse->lse_obj;
+			spinlock_acquire(&lock->spin);
+			bzero(&lock->stats, sizeof(lock->stats));
+			spinlock_release(&lock->spin);
+			break;
+		    case LOCKSTAT_CV:
+			cv = lse->lse_obj;
+			bzero(&cv->cv_stats, sizeof(cv->cv_stats));
+			break;
+		    case LOCKSTAT_SPIN:
+			splk = lse->lse_obj;
+			bzero(&splk->lk_stats, sizeof(splk->lk_stats));
+			break;
+		}
+	}
+	spinlock_release(&lockstat_lock);
+}
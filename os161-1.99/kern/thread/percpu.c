@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-cpu counters.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <current.h>
+#include <percpu.h>
+
+/*
+ * Storage for all the counters: one block per cpu, each counter
+ * having the same slot in every block. Slot 0 is never handed out so
+ * that a zero pc_slot can mean "not set up yet".
+ */
+struct pcpu_counterblock {
+	uint32_t pcb_counts[PCPU_COUNTERS];
+};
+
+static PERCPU_DEFINE(struct pcpu_counterblock, pcpu_counters);
+
+/* Next slot to hand out; protected by pcpu_slotlock. */
+static unsigned pcpu_nextslot = 1;
+static struct spinlock pcpu_slotlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Assign storage to a counter on first use. Two cpus can get here for
+ * the same counter at once; recheck under the lock so it only gets
+ * one slot.
+ */
+static
+void
+pcpu_counter_setup(struct pcpu_counter *pc)
+{
+	spinlock_acquire(&pcpu_slotlock);
+	if (pc->pc_slot == 0) {
+		if (pcpu_nextslot >= PCPU_COUNTERS) {
+			panic("pcpu_counter: out of counters\n");
+		}
+		pc->pc_slot = pcpu_nextslot++;
+	}
+	spinlock_release(&pcpu_slotlock);
+}
+
+/*
+ * Add to the count on the current cpu. Interrupts go off so that
+ * neither an interrupt handler counting on the same counter nor a
+ * preemption moving us to another cpu can come between the load and
+ * the store. Use splraise/spllower directly, as spinlocks do, so this
+ * works before curthread exists.
+ */
+void
+pcpu_counter_add(struct pcpu_counter *pc, uint32_t n)
+{
+	unsigned slot;
+
+	slot = pc->pc_slot;
+	if (slot == 0) {
+		pcpu_counter_setup(pc);
+		slot = pc->pc_slot;
+	}
+
+	splraise(IPL_NONE, IPL_HIGH);
+	PERCPU_THIS(pcpu_counters).pcb_counts[slot] += n;
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+void
+pcpu_counter_inc(struct pcpu_counter *pc)
+{
+	pcpu_counter_add(pc, 1);
+}
+
+/*
+ * Read one cpu's part of the count. A counter that has never been
+ * added to is zero everywhere.
+ */
+uint32_t
+pcpu_counter_readcpu(struct pcpu_counter *pc, unsigned cpunum)
+{
+	unsigned slot;
+
+	KASSERT(cpunum < MAXCPUS);
+
+	slot = pc->pc_slot;
+	if (slot == 0) {
+		return 0;
+	}
+	return PERCPU_CPU(pcpu_counters, cpunum).pcb_counts[slot];
+}
+
+/*
+ * Read the total. Every possible cpu's slot is added up; ones that
+ * have never run are zero.
+ */
+uint32_t
+pcpu_counter_read(struct pcpu_counter *pc)
+{
+	uint32_t total;
+	unsigned i;
+
+	total = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		total += pcpu_counter_readcpu(pc, i);
+	}
+	return total;
+}
+
+void
+pcpu_counter_zero(struct pcpu_counter *pc)
+{
+	unsigned slot, i;
+
+	slot = pc->pc_slot;
+	if (slot == 0) {
+		return;
+	}
+	for (i=0; i<MAXCPUS; i++) {
+		PERCPU_CPU(pcpu_counters, i).pcb_counts[slot] = 0;
+	}
+}
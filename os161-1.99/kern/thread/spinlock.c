@@ -48,8 +48,13 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	bzero(&lk->lk_stats, sizeof(lk->lk_stats));
+	bzero(&lk->lk_stat, sizeof(lk->lk_stat));
+#endif
 }
 
 /*
@@ -59,20 +64,30 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
+/*
+ * How long to back off per waiter ahead of us, in trips around an
+ * empty loop, before looking at the lock again.
+ */
+#define SPINLOCK_BACKOFF	32
+
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then take a ticket with
+ * a machine-level atomic operation and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	volatile unsigned delay;
+	unsigned spins = 0;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +102,41 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+	/*
+	 * Take a ticket. This is the only atomic operation; after it
+	 * we only read lk_serving, which changes once per release,
+	 * rather than all the waiters fighting over the lock word each
+	 * time it comes free the way test-and-set does.
+	 *
+	 * Tickets ahead of ours each have to be served first, so back
+	 * off in proportion to how many there are instead of reading
+	 * the lock continuously.
+	 */
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
 	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		serving = spinlock_data_get(&lk->lk_serving);
+		if (serving == ticket) {
+			break;
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+		spins++;
+		for (delay = (ticket - serving) * SPINLOCK_BACKOFF;
+		     delay > 0; delay--) {
+			/* nothing */
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	lk->lk_stats.ls_acquires++;
+	if (spins > 0) {
+		lk->lk_stats.ls_contended++;
+		lk->lk_stats.ls_spun++;
+		lk->lk_stats.ls_spins += spins;
+	}
+#else
+	(void)spins;
+#endif
 }
 
 /*
@@ -121,8 +150,10 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+	/* Only the holder writes lk_serving, so this needn't be atomic. */
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -139,3 +170,33 @@ spinlock_do_i_hold(struct spinlock *lk)
 	/* Assume we can read lk_holder atomically enough for this to work */
 	return (lk->lk_holder == curcpu->c_self);
 }
+
+/*
+ * Enter the lock in the lockstat registry.
+ */
+void
+spinlock_register(struct spinlock *lk, const char *name)
+{
+#if OPT_LOCKSTAT
+	lockstat_register(&lk->lk_stat, LOCKSTAT_SPIN, name, lk);
+#else
+	(void)lk;
+	(void)name;
+#endif
+}
+
+/*
+ * Copy out the statistics. This doesn't take the lock, so that the
+ * profiler can read locks it would otherwise have to order itself
+ * against; the numbers may be slightly torn.
+ */
+void
+spinlock_getstats(struct spinlock *lk, struct lockstats *ls)
+{
+#if OPT_LOCKSTAT
+	*ls = lk->lk_stats;
+#else
+	(void)lk;
+	bzero(ls, sizeof(*ls));
+#endif
+}
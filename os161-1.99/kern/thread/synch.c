@@ -34,9 +34,11 @@
 
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
 
@@ -62,13 +64,7 @@ sem_create(const char *name, int initial_count)
                 return NULL;
         }
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
-
+	wchan_init(&sem->sem_wchan, sem->sem_name, WCHAN_SLEEPQ);
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
 
@@ -82,7 +78,7 @@ sem_destroy(struct semaphore *sem)
 
 	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
+	wchan_cleanup(&sem->sem_wchan);
         kfree(sem->sem_name);
         kfree(sem);
 }
@@ -118,9 +114,9 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
-		wchan_lock(sem->sem_wchan);
+		wchan_lock(&sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
-                wchan_sleep(sem->sem_wchan);
+                wchan_sleep(&sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
         }
@@ -138,7 +134,7 @@ V(struct semaphore *sem)
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	wchan_wakeone(&sem->sem_wchan);
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -147,6 +143,86 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+// how many times a contended acquire may poll the lock before it
+// gives up spinning and sleeps
+#define LOCK_SPIN_MAX 2000
+
+// Priority inheritance.
+//
+// pi_lock protects every thread's t_inherit and t_blockedon, and the
+// owner of any lock with sleepers: while nwaiters > 0, owner only
+// changes hands with pi_lock held. That's what makes it safe to walk
+// from a lock to its owner, to the lock that owner is blocked on, and
+// so on, without the owners going away underneath us. Lock order is
+// a cv's sleep queue (cv_wait holds it across lock_release), then a
+// lock's spin, then pi_lock, then turnstiles and run queue locks.
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+// how far down a chain of blocked owners to pass priority on; a
+// longer chain than this is probably a deadlock anyway
+#define PI_MAXDEPTH 8
+
+// Lend LEVEL to the owner of LOCK, and to whoever that owner is
+// waiting for, and so on, until we reach someone already at LEVEL or
+// better.
+static void lock_pi_propagate(struct lock *lock, unsigned level) {
+  struct thread *owner;
+  unsigned depth;
+
+  KASSERT(spinlock_do_i_hold(&pi_lock));
+  for (depth = 0; lock != NULL && depth < PI_MAXDEPTH; depth++) {
+    owner = lock->owner;
+    if (owner == NULL || thread_level(owner) <= level) {
+      break;
+    }
+    thread_setinherit(owner, level);
+    lock = owner->t_blockedon;
+  }
+}
+
+// Work out what the current thread inherits from the sleepers on the
+// locks it still holds.
+static void lock_pi_recompute(void) {
+  struct lock *lock;
+  unsigned level = RUNQUEUE_LEVELS, top;
+
+  KASSERT(spinlock_do_i_hold(&pi_lock));
+  for (lock = curthread->t_heldlocks; lock != NULL; lock = lock->heldnext) {
+    top = wchan_toplevel(&lock->wc);
+    if (top < level) {
+      level = top;
+    }
+  }
+  if (level != curthread->t_inherit) {
+    thread_setinherit(curthread, level);
+  }
+}
+
+// Take LOCK off the current thread's list of held locks.
+static void lock_unlink_held(struct lock *lock) {
+  struct lock **pp;
+
+  for (pp = &curthread->t_heldlocks; *pp != NULL; pp = &(*pp)->heldnext) {
+    if (*pp == lock) {
+      *pp = lock->heldnext;
+      lock->heldnext = NULL;
+      return;
+    }
+  }
+  panic("lock %s not on its owner's held list\n", lock->lk_name);
+}
+
+// A thread cv_broadcast moved onto LOCK's channel has been woken and
+// is about to go through lock_acquire: stop counting it as blocked.
+static void lock_unrequeue(struct lock *lock) {
+  spinlock_acquire(&lock->spin);
+  spinlock_acquire(&pi_lock);
+  curthread->t_blockedon = NULL;
+  lock->nwaiters--;
+  spinlock_release(&pi_lock);
+  spinlock_release(&lock->spin);
+}
+
 struct lock* lock_create(const char *name) {
   struct lock* lock;
   
@@ -168,49 +244,144 @@ struct lock* lock_create(const char *name) {
   
   // initialize owner to NULL
   lock->owner = NULL;
+  lock->ownercpu = NULL;
+  lock->nwaiters = 0;
+  lock->heldnext = NULL;
+
+#if OPT_LOCKSTAT
+  // no statistics yet
+  bzero(&lock->stats, sizeof(lock->stats));
+  lock->acquiredns = 0;
+#endif
   
-  // initialize wait channels
-  lock->wc = wchan_create(lock->lk_name);
-  if (lock->wc == NULL) {
-    kfree(lock->lk_name);
-    kfree(lock);
-    return NULL;
-  }
+  // initialize wait channel; lock waits go in the turnstiles
+  wchan_init(&lock->wc, lock->lk_name, WCHAN_TURNSTILE);
   // initialize spinlock
   spinlock_init(&lock->spin);
+  lockstat_register(&lock->lk_stat, LOCKSTAT_LOCK, lock->lk_name, lock);
   return lock;
 }
 
 void lock_destroy(struct lock *lock) {
   KASSERT(lock != NULL);
 
+  // keep the numbers for the profile after the lock is gone
+  lockstat_unregister(&lock->lk_stat, &lock->stats);
+
   // add stuff here as needed
   // free spinlock
   spinlock_cleanup(&lock->spin);
-  // free wait channels
-  wchan_destroy(lock->wc);  
+  // free wait channel
+  wchan_cleanup(&lock->wc);
   // free string in heap
   kfree(lock->lk_name);
   // destroy the lock 
   kfree(lock);
 }
 
+// Check if the lock's owner is running on the cpu it acquired the
+// lock on. This only looks at the cpu, never at the owner thread
+// itself, which might exit and be freed while we aren't holding spin.
+// (If the owner moved cpus since, we just don't spin.)
+static bool lock_owner_running(struct lock *lock, struct thread *owner) {
+  struct cpu *c = lock->ownercpu;
+
+  return c != NULL && c->c_curthread == owner && !c->c_isidle;
+}
+
+// Spin (with spin released) while the lock stays held by the same
+// owner and that owner is running on another cpu, using up *budget.
+// Returns true if we stopped because the lock changed hands, so the
+// caller should look again; false if it should sleep instead.
+static bool lock_spin(struct lock *lock, unsigned *budget) {
+  struct thread *owner;
+
+  KASSERT(spinlock_do_i_hold(&lock->spin));
+  owner = lock->owner;
+  if (*budget == 0 || owner == NULL || !lock_owner_running(lock, owner)) {
+    return false;
+  }
+
+  spinlock_release(&lock->spin);
+  while (lock->held && lock->owner == owner && *budget > 0 &&
+         lock_owner_running(lock, owner)) {
+    (*budget)--;
+  }
+  spinlock_acquire(&lock->spin);
+
+  return !lock->held || lock->owner != owner;
+}
+
 void lock_acquire(struct lock *lock) {
+  unsigned budget = LOCK_SPIN_MAX;
+#if OPT_LOCKSTAT
+  bool contended = false, slept = false;
+  uint64_t start = 0, wait;
+#endif
+
   KASSERT(lock != NULL);
   KASSERT(!lock_do_i_hold(lock));
   
   spinlock_acquire(&lock->spin);
+#if OPT_LOCKSTAT
+  if (lock->held) {
+    contended = true;
+    start = gettime_nsecs();
+  }
+#endif
   while (lock->held == true) {
-    wchan_lock(lock->wc);
+    if (lock_spin(lock, &budget)) {
+      continue;
+    }
+#if OPT_LOCKSTAT
+    slept = true;
+    lock->stats.ls_slept++;
+#endif
+    lock->nwaiters++;
+    spinlock_acquire(&pi_lock);
+    curthread->t_blockedon = lock;
+    lock_pi_propagate(lock, thread_level(curthread));
+    spinlock_release(&pi_lock);
+    wchan_lock(&lock->wc);
     spinlock_release(&lock->spin);
-    wchan_sleep(lock->wc);
+    wchan_sleep(&lock->wc);
     spinlock_acquire(&lock->spin);
+    spinlock_acquire(&pi_lock);
+    curthread->t_blockedon = NULL;
+    spinlock_release(&pi_lock);
+    lock->nwaiters--;
   }
 
   lock->held = true;
   lock->owner = curthread;
+  lock->ownercpu = curcpu->c_self;
+  lock->heldnext = curthread->t_heldlocks;
+  curthread->t_heldlocks = lock;
+  if (lock->nwaiters > 0) {
+    // take over lending from those still asleep
+    spinlock_acquire(&pi_lock);
+    lock_pi_recompute();
+    spinlock_release(&pi_lock);
+  }
+#if OPT_LOCKSTAT
+  // the clock reads make this cost enough that only profiling
+  // kernels collect it; that includes timing how long it's held
+  lock->stats.ls_acquires++;
+  if (contended) {
+    lock->stats.ls_contended++;
+    if (!slept) {
+      lock->stats.ls_spun++;
+    }
+    lock->stats.ls_spins += LOCK_SPIN_MAX - budget;
+    wait = gettime_nsecs() - start;
+    lock->stats.ls_waitns += wait;
+    if (wait > lock->stats.ls_maxwaitns) {
+      lock->stats.ls_maxwaitns = wait;
+    }
+  }
+  lock->acquiredns = gettime_nsecs();
+#endif
   spinlock_release(&lock->spin);
-  //(void)lock;  // suppress warning until code gets written
 }
 
 void lock_release(struct lock *lock) {
@@ -218,23 +389,66 @@ void lock_release(struct lock *lock) {
   KASSERT(lock_do_i_hold(lock));
 
   spinlock_acquire(&lock->spin);
-  lock->held = false;
-  lock->owner = NULL;
+#if OPT_LOCKSTAT
+  if (lock->acquiredns != 0) {
+    uint64_t held = gettime_nsecs() - lock->acquiredns;
+
+    lock->stats.ls_holdns += held;
+    if (held > lock->stats.ls_maxholdns) {
+      lock->stats.ls_maxholdns = held;
+    }
+  }
+#endif
+  lock_unlink_held(lock);
+  if (lock->nwaiters > 0) {
+    // hand back what the sleepers lent us
+    spinlock_acquire(&pi_lock);
+    lock->held = false;
+    lock->owner = NULL;
+    lock->ownercpu = NULL;
+    lock_pi_recompute();
+    spinlock_release(&pi_lock);
+  }
+  else {
+    lock->held = false;
+    lock->owner = NULL;
+    lock->ownercpu = NULL;
+  }
   KASSERT(!lock->held);
-  wchan_wakeone(lock->wc);
+  wchan_wakeone(&lock->wc);
   spinlock_release(&lock->spin);
-  //(void)lock;  // suppress warning until code gets written
 }
 
 bool lock_do_i_hold(struct lock *lock) {
-  //(void)lock;  // suppress warning until code gets written
   KASSERT(lock);
   bool hold = false;
   spinlock_acquire(&lock->spin);
   hold = lock->owner == curthread && lock->held;
   spinlock_release(&lock->spin);
   return hold;
-  // dummy until code gets written
+}
+
+void lock_getstats(struct lock *lock, struct lockstats *ls) {
+  KASSERT(lock != NULL);
+
+#if OPT_LOCKSTAT
+  spinlock_acquire(&lock->spin);
+  *ls = lock->stats;
+  spinlock_release(&lock->spin);
+#else
+  bzero(ls, sizeof(*ls));
+#endif
+}
+
+void lock_printstats(struct lock *lock) {
+  struct lockstats ls;
+
+  // copy first; kprintf may sleep
+  lock_getstats(lock, &ls);
+  kprintf("lock %s: %u acquires, %u contended (%u spun, %u slept), "
+          "%llu us waiting (%llu us max)\n", lock->lk_name, ls.ls_acquires,
+          ls.ls_contended, ls.ls_spun, ls.ls_slept, ls.ls_waitns / 1000,
+          ls.ls_maxwaitns / 1000);
 }
 
 ////////////////////////////////////////////////////////////
@@ -256,12 +470,11 @@ struct cv* cv_create(const char *name) {
   }
 
   // add stuff here as needed
-  cv->wc = wchan_create(cv->cv_name);
-  // malloc fails
-  if (cv->wc == NULL) {
-    kfree(cv->cv_name);
-    kfree(cv);
-  }
+  wchan_init(&cv->wc, cv->cv_name, WCHAN_SLEEPQ);
+#if OPT_LOCKSTAT
+  bzero(&cv->cv_stats, sizeof(cv->cv_stats));
+#endif
+  lockstat_register(&cv->cv_stat, LOCKSTAT_CV, cv->cv_name, cv);
   return cv;
 }
 
@@ -270,38 +483,198 @@ void cv_destroy(struct cv *cv) {
 
 
   // add stuff here as needed
-  wchan_destroy(cv->wc);
+  lockstat_unregister(&cv->cv_stat, &cv->cv_stats);
+  wchan_cleanup(&cv->wc);
   kfree(cv->cv_name);
   kfree(cv);
 }
 
 void cv_wait(struct cv *cv, struct lock *lock) {
+#if OPT_LOCKSTAT
+  uint64_t start, wait;
+#endif
+
   KASSERT(cv);
   KASSERT(lock);
   
-  wchan_lock(cv->wc);
+#if OPT_LOCKSTAT
+  start = gettime_nsecs();
+#endif
+  wchan_lock(&cv->wc);
   lock_release(lock);
-  wchan_sleep(cv->wc);
+  wchan_sleep(&cv->wc);
+  // cv_broadcast may have moved us onto the lock's channel and counted
+  // us among its waiters; undo that before lock_acquire counts us
+  // again. (Only a broadcaster sets it while we sleep, and only while
+  // we're still on the channel, so it's safe to look without pi_lock.)
+  if (curthread->t_blockedon == lock) {
+    lock_unrequeue(lock);
+  }
   lock_acquire(lock);
-  //  Write this
-  //  (void)cv;    // suppress warning until code gets written
-  //  (void)lock;  // suppress warning until code gets written
+#if OPT_LOCKSTAT
+  // we hold the lock again, which is what protects these
+  wait = gettime_nsecs() - start;
+  cv->cv_stats.ls_acquires++;
+  cv->cv_stats.ls_slept++;
+  cv->cv_stats.ls_waitns += wait;
+  if (wait > cv->cv_stats.ls_maxwaitns) {
+    cv->cv_stats.ls_maxwaitns = wait;
+  }
+#endif
 }
 
 void cv_signal(struct cv *cv, struct lock *lock) {
   KASSERT(cv);
+  KASSERT(lock);
   
-  wchan_wakeone(cv->wc);
-  // Write this
-  //  (void)cv;    // suppress warning until code gets written
-    (void)lock;  // suppress warning until code gets written
+  wchan_wakeone(&cv->wc);
 }
 
+// Wait morphing: every waiter's next step is lock_acquire, so rather
+// than wake them all to fight over the lock, wake one and move the
+// rest onto the lock's wait channel, where each lock_release wakes
+// the next. Waking one (rather than none, on the grounds that the
+// caller holds the lock) keeps things going even if it doesn't.
+// cv_wait picks up at the same point whichever channel it's woken
+// from. (The wchan lock order, cv before lock, is the one cv_wait
+// already uses.)
+//
+// The moved threads are blocked on the lock as far as priority
+// inheritance goes, just as if they'd gone to sleep in lock_acquire:
+// they count in nwaiters, have t_blockedon set, and lend their
+// priority to the owner. That can't be done during the requeue,
+// since the lock's spin and pi_lock come before the cv's sleep queue,
+// so it's done afterwards from the lock's channel. Any the lock has
+// woken meanwhile are gone from it; they were never counted, and
+// without t_blockedon set cv_wait doesn't uncount them either.
 void cv_broadcast(struct cv *cv, struct lock *lock) {
   KASSERT(cv);
+  KASSERT(lock);
   
-  wchan_wakeall(cv->wc);
-  //  Write this
-  //  (void)cv;    // suppress warning until code gets written
-    (void)lock;  // suppress warning until code gets written
+  if (wchan_wakeone_requeue(&cv->wc, &lock->wc) == 0) {
+    return;
+  }
+  spinlock_acquire(&lock->spin);
+  spinlock_acquire(&pi_lock);
+  lock->nwaiters += wchan_markblocked(&lock->wc, lock);
+  lock_pi_propagate(lock, wchan_toplevel(&lock->wc));
+  spinlock_release(&pi_lock);
+  spinlock_release(&lock->spin);
+}
+
+#if OPT_LOCKSTAT
+void cv_getstats(struct cv *cv, struct lockstats *ls) {
+  KASSERT(cv != NULL);
+  // the caller may not hold the cv's lock, so this can be torn
+  *ls = cv->cv_stats;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock* rwlock_create(const char *name) {
+  struct rwlock *rw;
+
+  rw = kmalloc(sizeof(struct rwlock));
+  if (rw == NULL) {
+    return NULL;
+  }
+  rw->rw_name = kstrdup(name);
+  if (rw->rw_name == NULL) {
+    kfree(rw);
+    return NULL;
+  }
+  wchan_init(&rw->rw_readwc, rw->rw_name, WCHAN_TURNSTILE);
+  wchan_init(&rw->rw_writewc, rw->rw_name, WCHAN_TURNSTILE);
+  spinlock_init(&rw->rw_spin);
+  rw->rw_readers = 0;
+  rw->rw_waitwriters = 0;
+  rw->rw_writer = NULL;
+  return rw;
+}
+
+void rwlock_destroy(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+  KASSERT(rw->rw_readers == 0);
+  KASSERT(rw->rw_writer == NULL);
+  KASSERT(rw->rw_waitwriters == 0);
+
+  spinlock_cleanup(&rw->rw_spin);
+  wchan_cleanup(&rw->rw_readwc);
+  wchan_cleanup(&rw->rw_writewc);
+  kfree(rw->rw_name);
+  kfree(rw);
+}
+
+void rwlock_acquire_read(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+  KASSERT(rw->rw_writer != curthread);
+
+  spinlock_acquire(&rw->rw_spin);
+  // stay out while a writer is in or waiting, so writers aren't starved
+  while (rw->rw_writer != NULL || rw->rw_waitwriters > 0) {
+    wchan_lock(&rw->rw_readwc);
+    spinlock_release(&rw->rw_spin);
+    wchan_sleep(&rw->rw_readwc);
+    spinlock_acquire(&rw->rw_spin);
+  }
+  rw->rw_readers++;
+  spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_release_read(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+
+  spinlock_acquire(&rw->rw_spin);
+  KASSERT(rw->rw_readers > 0);
+  KASSERT(rw->rw_writer == NULL);
+  rw->rw_readers--;
+  // the last reader out lets a waiting writer in
+  if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+    wchan_wakeone(&rw->rw_writewc);
+  }
+  spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_acquire_write(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+  KASSERT(rw->rw_writer != curthread);
+
+  spinlock_acquire(&rw->rw_spin);
+  rw->rw_waitwriters++;
+  while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+    wchan_lock(&rw->rw_writewc);
+    spinlock_release(&rw->rw_spin);
+    wchan_sleep(&rw->rw_writewc);
+    spinlock_acquire(&rw->rw_spin);
+  }
+  rw->rw_waitwriters--;
+  rw->rw_writer = curthread;
+  spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_release_write(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+  KASSERT(rwlock_do_i_hold(rw));
+
+  spinlock_acquire(&rw->rw_spin);
+  rw->rw_writer = NULL;
+  // hand off to the next writer if there is one; otherwise let all
+  // the readers that piled up behind us in together
+  if (rw->rw_waitwriters > 0) {
+    wchan_wakeone(&rw->rw_writewc);
+  }
+  else {
+    wchan_wakeall(&rw->rw_readwc);
+  }
+  spinlock_release(&rw->rw_spin);
+}
+
+bool rwlock_do_i_hold(struct rwlock *rw) {
+  KASSERT(rw != NULL);
+  // only curthread can set or clear rw_writer to curthread, so this
+  // doesn't need the spinlock
+  return rw->rw_writer == curthread;
 }
@@ -35,6 +35,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/sched.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
@@ -50,6 +51,10 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <percpu.h>
+#include <syscall.h>
+#include <workqueue.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,13 +62,46 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/* Wait channel. */
-struct wchan {
-	const char *wc_name;		/* name for this channel */
-	struct threadlist wc_threads;	/* list of waiting threads */
-	struct spinlock wc_lock;	/* lock for mutual exclusion */
+/* Max number of dead threads (with their stacks) kept per cpu for reuse. */
+#define THREAD_CACHE_MAX 8
+
+/* Quanta a thread may use up at one priority level before it is demoted. */
+#define SCHED_ALLOTMENT 2
+
+/* Default quantum at the highest priority level, in hardclocks. */
+#define SCHED_QUANTUM 2
+
+/* A thread that slept less than this probably still has a warm cache. */
+#define WAKE_CACHEHOT_NSECS 1000000
+
+/* A thread left on a run queue longer than this is starving. */
+#define SCHED_STARVE_NSECS 200000000
+
+/*
+ * Sleep queues. Threads sleeping on a wait channel are kept in one of
+ * SLEEPQ_BUCKETS queues, hashed on the channel's address, rather than
+ * in the channel itself; a queue holds sleepers for any number of
+ * channels, told apart by t_wchan. So a wait channel is just a name
+ * and costs nothing while nobody sleeps on it.
+ *
+ * There are two tables (see wchan.h): one for lock waits, which
+ * never need another queue while their own is locked, and one for
+ * everything else. The only time two queues are locked at once is
+ * moving or waking lock waiters while holding a sleep queue (cv_wait
+ * releasing the lock, or cv_broadcast requeueing onto it), so the
+ * order is: sleep queue, then turnstile, and never two queues from
+ * the same table.
+ */
+#define SLEEPQ_BITS 6
+#define SLEEPQ_BUCKETS (1 << SLEEPQ_BITS)
+
+struct sleepq {
+	struct spinlock sq_lock;	/* lock for mutual exclusion */
+	struct threadlist sq_threads;	/* list of waiting threads */
 };
 
+static struct sleepq sleepqs[WCHAN_NTABLES][SLEEPQ_BUCKETS];
+
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -72,6 +110,26 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Scheduling quantum at the top priority level; see thread_setquantum. */
+static volatile unsigned sched_quantum = SCHED_QUANTUM;
+
+/*
+ * Load averages, updated by thread_loadavg_update. The decay factors
+ * are exp(-LOADAVG_INTERVAL/60), exp(-LOADAVG_INTERVAL/300), and
+ * exp(-LOADAVG_INTERVAL/900), in fixed point.
+ */
+static const unsigned loadavg_decay[3] = { 1884, 2014, 2037 };
+static volatile unsigned loadavg[3];
+
+/* Context switches done, per cpu; shown by thread_printstats. */
+static struct pcpu_counter thread_switches = PCPU_COUNTER_INITIALIZER;
+
+/* Per-cpu work item for cleaning up zombies; see thread_reap. */
+static PERCPU_DEFINE(struct work, exorcise_work);
+
+/* Body of the per-cpu idle threads; see cpu_create. */
+static void thread_idle(void *data1, unsigned long data2);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +169,79 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Return true if the guard band set up by thread_checkstack_init is
+ * still in place. Used to avoid refilling it on cached stacks.
+ */
+static
+bool
+thread_checkstack_isintact(struct thread *thread)
+{
+	return ((uint32_t *)thread->t_stack)[0] == THREAD_STACK_MAGIC &&
+		((uint32_t *)thread->t_stack)[1] == THREAD_STACK_MAGIC &&
+		((uint32_t *)thread->t_stack)[2] == THREAD_STACK_MAGIC &&
+		((uint32_t *)thread->t_stack)[3] == THREAD_STACK_MAGIC;
+}
+
+/*
+ * Per-cpu cache of dead thread structures, each still owning its
+ * kernel stack. thread_destroy puts threads here instead of freeing
+ * them, and thread_create takes them back out, so that forking and
+ * exiting threads doesn't cost a kmalloc/kfree round trip of a whole
+ * page each time.
+ *
+ * The cache is accessed only by its own cpu (thread_destroy runs from
+ * exorcise() on the cpu the thread died on), so all that's needed for
+ * exclusion is to keep interrupts off, which also keeps us from being
+ * preempted and migrated while looking at curcpu.
+ */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	/* this must work before curcpu initialization */
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	return thread;
+}
+
+/*
+ * Stash a dead thread in the cache. Returns false if the cache is
+ * full, in which case the caller should free it for real.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	bool ret;
+	int spl;
+
+	KASSERT(thread->t_stack != NULL);
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+
+	spl = splhigh();
+	ret = curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (ret) {
+		threadlistnode_init(&thread->t_listnode, thread);
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+	}
+	splx(spl);
+
+	return ret;
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -123,27 +254,57 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	/* Reuse a dead thread, and its stack, if this cpu has one. */
+	thread = thread_cache_get();
 	if (thread == NULL) {
-		return NULL;
+		thread = kmalloc(sizeof(*thread));
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+		if (thread->t_stack != NULL) {
+			kfree(thread->t_stack);
+		}
 		kfree(thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
+	thread->t_wchan = NULL;
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* t_stack is either NULL or a stack recycled from the cache */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 
+	/* Scheduler fields; new threads start at the top. */
+	thread->t_priority = 0;
+	thread->t_allotment = 0;
+	thread->t_slice = 0;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_inherit = RUNQUEUE_LEVELS;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
+
+	/* Timed sleep fields */
+	thread->t_wakeup = 0;
+	thread->t_timernext = NULL;
+
+	/* Accounting fields */
+	thread->t_stamp = gettime_nsecs();
+	thread->t_runtime = 0;
+	thread->t_waittime = 0;
+	thread->t_sleeptime = 0;
+	thread->t_nvcsw = 0;
+	thread->t_nivcsw = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -167,6 +328,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -179,15 +341,26 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
+	c->c_migrating = NULL;
+	c->c_idlethread = NULL;
 	c->c_hardclocks = 0;
+	c->c_busytime = 0;
+	c->c_idletime = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	c->c_resched = false;
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_register(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_register(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
@@ -213,7 +386,7 @@ cpu_create(unsigned hardware_number)
 		 */
 		/*c->c_curthread->t_stack = ... */
 	}
-	else {
+	else if (c->c_curthread->t_stack == NULL) {
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
@@ -222,6 +395,33 @@ cpu_create(unsigned hardware_number)
 	}
 	c->c_curthread->t_cpu = c;
 
+	/*
+	 * The idle thread gives the cpu a stack to idle on when the
+	 * thread that was running has to leave it (see thread_switch).
+	 * It never goes on a run queue; it's switched to directly.
+	 *
+	 * It runs as part of the kernel process, but isn't added to its
+	 * thread list, so it doesn't show up as one of its threads (in
+	 * ps, say); idling used to happen on whatever thread was there.
+	 */
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	c->c_idlethread = thread_create(namebuf);
+	if (c->c_idlethread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	if (c->c_idlethread->t_stack == NULL) {
+		c->c_idlethread->t_stack = kmalloc(STACK_SIZE);
+		if (c->c_idlethread->t_stack == NULL) {
+			panic("cpu_create: couldn't allocate stack");
+		}
+		thread_checkstack_init(c->c_idlethread);
+	}
+	c->c_idlethread->t_proc = kproc;
+	c->c_idlethread->t_cpu = c;
+	/* It starts out holding the run queue lock; see thread_fork. */
+	c->c_idlethread->t_iplhigh_count++;
+	switchframe_init(c->c_idlethread, thread_idle, NULL, 0);
+
 	cpu_machdep_init(c);
 
 	return c;
@@ -249,9 +449,6 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -259,6 +456,22 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+	thread->t_name = NULL;
+
+	/*
+	 * Keep the structure and its stack for the next thread_create
+	 * if there's room. Don't recycle a stack whose guard band has
+	 * been trashed; thread_checkstack would have caught that on
+	 * the way out through thread_exit, but threads destroyed
+	 * because thread_fork failed never went through there.
+	 */
+	if (thread->t_stack != NULL) {
+		if (thread_checkstack_isintact(thread) &&
+		    thread_cache_put(thread)) {
+			return;
+		}
+		kfree(thread->t_stack);
+	}
 	kfree(thread);
 }
 
@@ -281,6 +494,41 @@ exorcise(void)
 	}
 }
 
+/*
+ * Work function for exorcise_work. Runs in the worker thread of
+ * whatever cpu it's on; interrupts go off to get at that cpu's
+ * zombies and thread cache, as in thread_switch.
+ */
+static
+void
+exorcise_work_run(void *junk)
+{
+	int spl;
+
+	(void)junk;
+
+	spl = splhigh();
+	exorcise();
+	splx(spl);
+}
+
+/*
+ * Called after every context switch: if threads have died on this
+ * cpu, have the worker clean them up instead of doing it on the way
+ * into whatever thread just got the cpu. The work item is only queued
+ * once however many zombies pile up in the meantime, and they're
+ * cleaned up together.
+ */
+static
+void
+thread_reap(void)
+{
+	if (threadlist_isempty(&curcpu->c_zombies)) {
+		return;
+	}
+	workqueue_add(&PERCPU_THIS(exorcise_work));
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -289,6 +537,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +553,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -340,6 +593,69 @@ thread_shutdown(void)
 	ipi_broadcast(IPI_OFFLINE);
 }
 
+/*
+ * Set up the sleep queues.
+ */
+static
+void
+sleepq_bootstrap(void)
+{
+	unsigned i, j;
+
+	for (i = 0; i < WCHAN_NTABLES; i++) {
+		for (j = 0; j < SLEEPQ_BUCKETS; j++) {
+			spinlock_init(&sleepqs[i][j].sq_lock);
+			spinlock_register(&sleepqs[i][j].sq_lock,
+				i == WCHAN_TURNSTILE ? "turnstile" : "sleepq");
+			threadlist_init(&sleepqs[i][j].sq_threads);
+		}
+	}
+}
+
+/*
+ * Find the sleep queue for a wait channel.
+ */
+static
+struct sleepq *
+sleepq_get(struct wchan *wc)
+{
+	uint32_t hash;
+
+	KASSERT(wc->wc_table < WCHAN_NTABLES);
+
+	/* Multiplicative hash; the low bits are mostly alignment. */
+	hash = ((uint32_t)(uintptr_t)wc >> 3) * 2654435761U;
+	return &sleepqs[wc->wc_table][hash >> (32 - SLEEPQ_BITS)];
+}
+
+/*
+ * Take T off sleep queue SQ, which must be locked.
+ */
+static
+void
+sleepq_remove(struct sleepq *sq, struct thread *t)
+{
+	threadlist_remove(&sq->sq_threads, t);
+	t->t_wchan = NULL;
+}
+
+/*
+ * Find the first thread in SQ sleeping on WC, or NULL.
+ */
+static
+struct thread *
+sleepq_first(struct sleepq *sq, struct wchan *wc)
+{
+	struct thread *t;
+
+	THREADLIST_FORALL(t, sq->sq_threads) {
+		if (t->t_wchan == wc) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
 /*
  * Thread system initialization.
  */
@@ -348,8 +664,14 @@ thread_bootstrap(void)
 {
 	struct cpu *bootcpu;
 	struct thread *bootthread;
+	unsigned i;
 
 	cpuarray_init(&allcpus);
+	sleepq_bootstrap();
+	for (i=0; i<MAXCPUS; i++) {
+		work_init(&PERCPU_CPU(exorcise_work, i), exorcise_work_run,
+			  NULL);
+	}
 
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
@@ -426,16 +748,366 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue level of T: its own priority, or the one it inherited
+ * from waiters on its locks if that's better.
+ */
+unsigned
+thread_level(struct thread *t)
+{
+	return t->t_inherit < t->t_priority ? t->t_inherit : t->t_priority;
+}
+
+/*
+ * Run queue operations. The run queue is an array of thread lists,
+ * one per priority level; these keep c_runcount in step with them.
+ * The caller must hold the cpu's run queue lock.
+ */
+
+/* Queue T at the tail of its level. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(thread_level(t) < RUNQUEUE_LEVELS);
+
+	threadlist_addtail(&c->c_runqueue[thread_level(t)], t);
+	c->c_runcount++;
+}
+
+/* Take the next thread to run: the head of the highest nonempty level. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Check if T's affinity lets it run on cpu C. */
+static
+bool
+thread_cpu_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
+
+/*
+ * Take the thread that would run last and is allowed on cpu DEST, for
+ * moving it there.
+ *
+ * Ordinarily, C's curthread will not appear on its run queue.
+ * However, it can under the following circumstances:
+ *   - it went to sleep;
+ *   - the processor became idle, so it remained curthread;
+ *   - it was reawakened, so it was put on the run queue;
+ *   - and the processor hasn't fully unidled yet, so all
+ *     these things are still true.
+ *
+ * That processor is still running on the thread's stack, so taking
+ * it would be a disaster; skip it.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c, struct cpu *dest)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=RUNQUEUE_LEVELS; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[i]) {
+			if (t != c->c_curthread && thread_cpu_allowed(t, dest)) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_runcount--;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Length of a quantum for T at its current priority level. Lower
+ * levels hold cpu-bound threads, which get longer quanta so they
+ * switch (and flush the TLB) less often.
+ */
+static
+unsigned
+thread_quantum(struct thread *t)
+{
+	return sched_quantum << t->t_priority;
+}
+
+/*
+ * Return the highest priority level with a thread waiting on it, or
+ * RUNQUEUE_LEVELS if the run queue is empty.
+ */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Thread migration.
+ *
+ * Rather than have busy cpus periodically push threads elsewhere
+ * (which means locking every cpu's run queue in turn just to count
+ * them), cpus that run out of work pull it: thread_switch calls this
+ * before going idle, and also when yielding with nothing else to run.
+ * We pick the cpu with the longest run queue and take the thread at
+ * its tail, which is the one that would otherwise wait longest.
+ *
+ * MINQUEUED is how many threads the other cpu must have waiting
+ * before it's worth taking one: 1 when we'd otherwise idle, more when
+ * we already have something running.
+ *
+ * The queue lengths are peeked at without locking; they're only a
+ * hint, and we recheck under the victim's lock. We must not hold our
+ * own run queue lock here, or two cpus stealing from each other could
+ * deadlock.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. But System/161 does not (yet) model such
+ * cache effects, and a cpu that would otherwise sit idle loses
+ * nothing by taking work.
+ *
+ * Returns the stolen thread, already assigned to this cpu but not on
+ * any run queue, or NULL.
+ */
+static
+struct thread *
+thread_steal(unsigned minqueued)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	KASSERT(minqueued > 0);
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	victim = NULL;
+	most = minqueued - 1;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_runcount > most) {
+			most = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	if (victim->c_runcount < minqueued) {
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	t = runqueue_remtail(victim, curcpu->c_self);
+	if (t == NULL) {
+		/* Nothing there is allowed to run here. */
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	t->t_cpu = curcpu->c_self;
+	spinlock_release(&victim->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	return t;
+}
+
+/*
+ * Pick a cpu in T's affinity mask for it to run on: the one with the
+ * fewest threads waiting, going by an unlocked peek. Prefer T's
+ * current cpu on ties, for the sake of its cache.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	best = NULL;
+	if (thread_cpu_allowed(t, t->t_cpu)) {
+		best = t->t_cpu;
+	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (thread_cpu_allowed(t, c) &&
+		    (best == NULL || c->c_runcount < best->c_runcount)) {
+			best = c;
+		}
+	}
+	return best != NULL ? best : t->t_cpu;
+}
+
+/*
+ * Check if cpu C is idle with nothing yet on the way; BUSY is a mask
+ * of cpus already given work that they haven't picked up yet.
+ */
+static
+bool
+thread_cpu_free(struct cpu *c, uint32_t busy)
+{
+	return c->c_isidle && (busy & ((uint32_t)1 << c->c_number)) == 0;
+}
+
+/*
+ * Wakeup placement: choose the cpu to queue T on when it becomes
+ * runnable. In order of preference:
+ *
+ *   - the cpu it last ran on, if that's idle, or if nothing is
+ *     waiting there and T only slept briefly, so its cache
+ *     footprint is probably still warm;
+ *   - some other idle cpu, so T doesn't wait behind a busy one;
+ *   - the waker's cpu, if fewer threads are waiting there: whatever
+ *     T was waiting for was likely just produced there, so is in
+ *     that cache;
+ *   - the cpu it last ran on.
+ *
+ * Only cpus in T's affinity mask count. BUSY is as for
+ * thread_cpu_free; wchan_wakeall uses it so a batch of wakeups spreads
+ * over the idle cpus instead of piling onto the first. The idle flags
+ * and queue lengths are peeked at without locking; this is only a
+ * heuristic.
+ */
+static
+struct cpu *
+thread_wakecpu(struct thread *t, uint32_t busy)
+{
+	struct cpu *prev, *waker, *c;
+	unsigned i, numcpus;
+	bool prevok;
+
+	prev = t->t_cpu;
+	waker = curcpu->c_self;
+	prevok = thread_cpu_allowed(t, prev);
+
+	if (prevok) {
+		if (thread_cpu_free(prev, busy)) {
+			return prev;
+		}
+		if (prev->c_runcount == 0 && t->t_state == S_SLEEP &&
+		    gettime_nsecs() - t->t_stamp < WAKE_CACHEHOT_NSECS) {
+			return prev;
+		}
+	}
+
+	/* Look for an idle cpu, starting after prev to spread the load. */
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<=numcpus; i++) {
+		c = cpuarray_get(&allcpus, (prev->c_number + i) % numcpus);
+		if (thread_cpu_allowed(t, c) && thread_cpu_free(c, busy)) {
+			return c;
+		}
+	}
+
+	if (thread_cpu_allowed(t, waker) &&
+	    (!prevok || waker->c_runcount < prev->c_runcount)) {
+		return waker;
+	}
+	if (prevok) {
+		return prev;
+	}
+	return thread_pickcpu(t);
+}
+
+/*
+ * Move T, which is on no run queue, to NEWCPU, and return the cpu it
+ * ends up on.
+ *
+ * T's old cpu may still be running on T's stack: it keeps its run
+ * queue lock across the switch away from T, but if it found nothing
+ * else to run it idles on T's stack with T still as curthread. So T
+ * may only move if, holding the old cpu's run queue lock, its
+ * curthread is something else. Otherwise T stays put for now and
+ * moves at a later switch.
+ */
+static
+struct cpu *
+thread_relocate(struct thread *t, struct cpu *newcpu)
+{
+	struct cpu *oldcpu;
+
+	oldcpu = t->t_cpu;
+
+	spinlock_acquire(&oldcpu->c_runqueue_lock);
+	if (oldcpu->c_curthread != t) {
+		t->t_cpu = newcpu;
+	}
+	spinlock_release(&oldcpu->c_runqueue_lock);
+
+	return t->t_cpu;
+}
+
+/*
+ * Return the time since T's last state change and restart its clock.
+ * Threads stamped before the clock was configured don't get charged
+ * for that first interval.
+ */
+static
+uint64_t
+thread_account(struct thread *t, uint64_t now)
+{
+	uint64_t delta;
+
+	delta = 0;
+	if (t->t_stamp != 0 && now > t->t_stamp) {
+		delta = now - t->t_stamp;
+	}
+	t->t_stamp = now;
+	return delta;
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * Unless we already hold a run queue lock (meaning TARGET is the
+ * current thread and is staying on this cpu), the thread goes
+ * wherever thread_wakecpu says. targetcpu might be curcpu; it might
+ * not be, too.
+ *
+ * If the target cpu is idle it needs an IPI to notice the new work.
+ * If UNIDLE is not NULL, the cpu is added to that mask instead, for
+ * the caller to send the IPIs in one go with thread_unidle.
  */
 static
 void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+thread_enqueue(struct thread *target, bool already_have_lock,
+	       uint32_t *unidle)
 {
-	struct cpu *targetcpu;
+	struct cpu *targetcpu, *newcpu;
 	bool isidle;
 
 	/* Lock the run queue of the target thread's cpu. */
@@ -446,21 +1118,94 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
+		newcpu = thread_wakecpu(target, unidle != NULL ? *unidle : 0);
+		if (newcpu != targetcpu) {
+			targetcpu = thread_relocate(target, newcpu);
+		}
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
-	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-	if (isidle) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+	/*
+	 * A thread coming back from wchan_sleep gave up the cpu on its
+	 * own, so is probably interactive or I/O-bound; move it up a
+	 * level. (Its state can't change underneath us: the sleeper
+	 * sets S_SLEEP before this run queue lock is released.)
+	 */
+	if (target->t_state == S_SLEEP) {
+		if (target->t_priority > 0) {
+			target->t_priority--;
+		}
+		target->t_allotment = 0;
+		target->t_sleeptime += thread_account(target, gettime_nsecs());
+	}
+
+	isidle = targetcpu->c_isidle;
+	runqueue_add(targetcpu, target);
+
+	/*
+	 * If this outranks what the cpu is running, have it switch at
+	 * the next hardclock rather than waiting out the quantum.
+	 */
+	if (thread_level(target) < thread_level(targetcpu->c_curthread)) {
+		targetcpu->c_resched = true;
+	}
+	if (isidle) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		if (unidle != NULL) {
+			*unidle |= (uint32_t)1 << targetcpu->c_number;
+		}
+		else {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	thread_enqueue(target, already_have_lock, NULL);
+}
+
+/*
+ * Send IPI_UNIDLE to each cpu in MASK, as collected by thread_enqueue.
+ */
+static
+void
+thread_unidle(uint32_t mask)
+{
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus && mask != 0; i++) {
+		if (mask & ((uint32_t)1 << i)) {
+			ipi_send(cpuarray_get(&allcpus, i), IPI_UNIDLE);
+			mask &= ~((uint32_t)1 << i);
+		}
 	}
+}
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+/*
+ * Requeue the thread thread_switch left in c_migrating, if any. Called
+ * after the switch, when we're no longer on its stack.
+ */
+static
+void
+thread_migrate_pending(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrating;
+	if (t != NULL) {
+		curcpu->c_migrating = NULL;
+		thread_make_runnable(t, false);
 	}
 }
 
@@ -492,13 +1237,19 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/*
+	 * Allocate a stack, unless thread_create handed us a recycled
+	 * thread that already has one. The guard band on a recycled
+	 * stack was verified intact when it went into the cache.
+	 */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -506,6 +1257,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -548,6 +1300,8 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	uint64_t now, delta;
+	bool migrate;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -570,27 +1324,88 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/*
+	 * If we're yielding with nothing else to run, see if some
+	 * other cpu has a backlog; if it has at least two threads
+	 * waiting, taking one evens things out.
+	 */
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
+		next = thread_steal(2);
+		if (next != NULL) {
+			spinlock_acquire(&curcpu->c_runqueue_lock);
+			runqueue_add(curcpu, next);
+			spinlock_release(&curcpu->c_runqueue_lock);
+		}
+	}
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * A thread yielding on a cpu outside its affinity mask moves
+	 * elsewhere. If there's nothing else to run here, this cpu
+	 * idles on its idle thread instead.
+	 */
+	migrate = newstate == S_READY && !thread_cpu_allowed(cur, curcpu);
+
+	/*
+	 * If yielding and nothing of the same or higher priority is
+	 * waiting, just keep running. (This includes the case where
+	 * the run queue is empty.) The idle thread only yields to
+	 * look for something else, so it never keeps running.
+	 */
+	if (newstate == S_READY && !migrate &&
+	    cur != curcpu->c_idlethread &&
+	    runqueue_toplevel(curcpu) > thread_level(cur)) {
+		curcpu->c_resched = false;
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/*
+	 * Charge the outgoing thread for its time on the cpu. Yielding
+	 * counts as involuntary, as it does in Unix; only blocking is
+	 * voluntary.
+	 */
+	now = gettime_nsecs();
+	delta = thread_account(cur, now);
+	cur->t_runtime += delta;
+	curcpu->c_busytime += delta;
+	pcpu_counter_inc(&thread_switches);
+	if (newstate == S_SLEEP) {
+		cur->t_nvcsw++;
+	}
+	else if (newstate == S_READY) {
+		cur->t_nivcsw++;
+	}
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if (migrate) {
+			/*
+			 * We can't put ourselves on another cpu's run
+			 * queue while still on our own stack; leave it
+			 * to thread_migrate_pending after the switch.
+			 */
+			KASSERT(curcpu->c_migrating == NULL);
+			curcpu->c_migrating = cur;
+			break;
+		}
+		if (cur == curcpu->c_idlethread) {
+			/* Not queued; see cpu_create. */
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
-		 * Add the thread to the list in the wait channel, and
+		 * Add the thread to the channel's sleep queue, and
 		 * unlock same. To avoid a race with someone else
 		 * calling wchan_wake*, we must keep the wchan locked
 		 * from the point the caller of wchan_sleep locked it
@@ -602,7 +1417,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * or want it locked and if it does can lock it itself
 		 * without racing. Exercise: what's the other?)
 		 */
-		threadlist_addtail(&wc->wc_threads, cur);
+		threadlist_addtail(&sleepq_get(wc)->sq_threads, cur);
 		wchan_unlock(wc);
 		break;
 	    case S_ZOMBIE:
@@ -613,7 +1428,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call md_idle(). If
+	 * the current thread is moving to another cpu, though, we
+	 * can't idle on its stack: it may start running elsewhere as
+	 * soon as it's sent off. Switch to the idle thread instead,
+	 * which sends it off and then idles.
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -632,15 +1452,33 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal(1);
+			if (next == NULL && curcpu->c_migrating != NULL) {
+				next = curcpu->c_idlethread;
+			}
+			if (next == NULL) {
+				now = gettime_nsecs();
+				cpu_idle();
+				if (now != 0) {
+					curcpu->c_idletime +=
+						gettime_nsecs() - now;
+				}
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Start the next thread on a fresh quantum. */
+	next->t_slice = thread_quantum(next);
+	curcpu->c_resched = false;
+
+	/* Charge the incoming thread for its time on the run queue. */
+	next->t_waittime += thread_account(next, gettime_nsecs());
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -708,11 +1546,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the previous thread if it's changing cpus. */
+	thread_migrate_pending();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
 	/* Clean up dead threads. */
-	exorcise();
+	thread_reap();
 
 	/* Turn interrupts back on. */
 	splx(spl);
@@ -741,11 +1582,14 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the previous thread if it's changing cpus. */
+	thread_migrate_pending();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
 	/* Clean up dead threads. */
-	exorcise();
+	thread_reap();
 
 	/* Enable interrupts. */
 	spl0();
@@ -768,6 +1612,23 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	thread_exit();
 }
 
+/*
+ * The idle thread: each time it's switched to, go straight back into
+ * thread_switch to run something else, idling there until there's
+ * something.
+ */
+static
+void
+thread_idle(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		thread_switch(S_READY, NULL);
+	}
+}
+
 /*
  * Cause the current thread to exit.
  *
@@ -817,144 +1678,304 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
-////////////////////////////////////////////////////////////
-
 /*
- * Scheduler.
+ * Called on every hardclock. Count down the current thread's quantum
+ * and preempt it when the quantum runs out, or early if a thread of
+ * higher priority has become runnable on this cpu.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * A thread that uses up SCHED_ALLOTMENT quanta at one level is
+ * demoted to the next one down, so cpu hogs sink below threads that
+ * sleep a lot.
+ *
+ * A thread running outside its affinity mask is switched out at once
+ * so thread_switch can move it.
  */
-
 void
-schedule(void)
+thread_consider_preemption(void)
 {
+	struct thread *cur;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If the cpu is idle, curthread is whatever thread last went
+	 * to sleep here; don't charge it for the idle time.
 	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	if (cur->t_slice > 0) {
+		cur->t_slice--;
+	}
+
+	/* c_resched is only a hint, so don't bother locking for it */
+	if (cur->t_slice > 0 && !curcpu->c_resched &&
+	    thread_cpu_allowed(cur, curcpu)) {
+		return;
+	}
+
+	if (cur->t_slice == 0) {
+		cur->t_allotment++;
+		if (cur->t_allotment >= SCHED_ALLOTMENT) {
+			if (cur->t_priority < RUNQUEUE_LEVELS - 1) {
+				cur->t_priority++;
+			}
+			cur->t_allotment = 0;
+		}
+		/* In case nothing else gets to run after all. */
+		cur->t_slice = thread_quantum(cur);
+	}
+
+	thread_switch(S_READY, NULL);
+}
+
+unsigned
+thread_getquantum(void)
+{
+	return sched_quantum;
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Change the quantum. Threads already running finish out the quantum
+ * they have; the new value applies from their next one.
+ */
+int
+thread_setquantum(int hardclocks)
+{
+	if (hardclocks < 1 || hardclocks > HZ) {
+		return EINVAL;
+	}
+	sched_quantum = hardclocks;
+	return 0;
+}
+
+/*
+ * Change T's affinity mask. Only cpus that exist count; if none of
+ * them are in MASK, fail.
+ */
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	unsigned numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32 && (mask & (((uint32_t)1 << numcpus) - 1)) == 0) {
+		return EINVAL;
+	}
+	t->t_affinity = mask;
+
+	if (t == curthread && !thread_cpu_allowed(t, curcpu)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+/*
+ * Set the level T inherits. If T is on a run queue it has to move to
+ * the list for its new level; if the change means T or the thread
+ * running where it's queued is now outranked, ask for a switch.
  */
 void
-thread_consider_migration(void)
+thread_setinherit(struct thread *t, unsigned level)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *x;
+	unsigned old;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
+	KASSERT(level <= RUNQUEUE_LEVELS);
+
+	/* t_cpu only changes under the old cpu's run queue lock. */
+	while (1) {
+		c = t->t_cpu;
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (t->t_cpu == c) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	old = thread_level(t);
+	t->t_inherit = level;
+	if (thread_level(t) != old) {
+		THREADLIST_FORALL(x, c->c_runqueue[old]) {
+			if (x == t) {
+				threadlist_remove(&c->c_runqueue[old], t);
+				threadlist_addtail(
+					&c->c_runqueue[thread_level(t)], t);
+				if (thread_level(t) <
+				    thread_level(c->c_curthread)) {
+					c->c_resched = true;
+				}
+				break;
+			}
+		}
+		if (t == c->c_curthread &&
+		    runqueue_toplevel(c) < thread_level(t)) {
+			c->c_resched = true;
+		}
 	}
+	spinlock_release(&c->c_runqueue_lock);
+}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
+uint32_t
+thread_getaffinity(struct thread *t)
+{
+	return t->t_affinity;
+}
+
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler.
+ *
+ * This is called periodically from hardclock(). It should reshuffle
+ * the current CPU's run queue by job priority.
+ *
+ * The run queue is a multi-level feedback queue: thread_switch always
+ * picks from the highest nonempty level, round-robin within a level.
+ * Threads that keep using up their quanta are demoted by
+ * thread_consider_preemption(), and threads waking up from sleep are promoted by
+ * thread_make_runnable(). Left at that, a steady supply of
+ * high-priority work could starve the lower levels forever, so here
+ * we move up one level any thread that has been waiting longer than
+ * SCHED_STARVE_NSECS. A queued thread's t_stamp is when it was put on
+ * the run queue, so it keeps climbing on later calls until it runs;
+ * threads that are getting the cpu in reasonable time stay put.
+ */
+
+void
+schedule(void)
+{
+	struct threadlist *tl;
+	struct thread *t;
+	uint64_t now;
+	unsigned i, n;
+
+	now = gettime_nsecs();
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	for (i=1; i<RUNQUEUE_LEVELS; i++) {
+		/* Rotate the list once, so the ones left keep their order. */
+		tl = &curcpu->c_runqueue[i];
+		for (n = tl->tl_count; n > 0; n--) {
+			t = threadlist_remhead(tl);
+			KASSERT(t != NULL);
+			if (now > t->t_stamp &&
+			    now - t->t_stamp > SCHED_STARVE_NSECS) {
+				t->t_priority = i - 1;
+				t->t_allotment = 0;
+				threadlist_addtail(&curcpu->c_runqueue[i - 1], t);
+			}
+			else {
+				threadlist_addtail(tl, t);
+			}
+		}
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+////////////////////////////////////////////////////////////
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+/*
+ * Scheduling statistics.
+ */
+
+void
+thread_getstats(struct thread *t, struct schedstats *ss)
+{
+	uint64_t now, since;
+	unsigned i;
+
+	now = gettime_nsecs();
+	since = 0;
+	if (t->t_stamp != 0 && now > t->t_stamp) {
+		since = now - t->t_stamp;
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	ss->ss_runtime = t->t_runtime;
+	ss->ss_waittime = t->t_waittime;
+	ss->ss_sleeptime = t->t_sleeptime;
+	switch (t->t_state) {
+	    case S_RUN:
+		ss->ss_runtime += since;
+		break;
+	    case S_READY:
+		ss->ss_waittime += since;
+		break;
+	    case S_SLEEP:
+		ss->ss_sleeptime += since;
+		break;
+	    case S_ZOMBIE:
+		break;
+	}
+	ss->ss_nvcsw = t->t_nvcsw;
+	ss->ss_nivcsw = t->t_nivcsw;
+	for (i=0; i<3; i++) {
+		ss->ss_loadavg[i] = loadavg[i];
+	}
+}
+
+/*
+ * Sample the number of threads running or waiting to run, and fold it
+ * into the load averages. The counts are read without locking; a load
+ * average doesn't need to be exact.
+ */
+void
+thread_loadavg_update(void)
+{
+	struct cpu *c;
+	unsigned i, num, n;
+
+	n = 0;
+	num = cpuarray_num(&allcpus);
+	for (i=0; i<num; i++) {
+		c = cpuarray_get(&allcpus, i);
+		n += c->c_runcount;
+		if (!c->c_isidle) {
+			n++;
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	for (i=0; i<3; i++) {
+		loadavg[i] = (loadavg[i] * loadavg_decay[i] +
+			      n * LOADAVG_SCALE * (LOADAVG_SCALE - loadavg_decay[i]))
+			>> LOADAVG_SHIFT;
+	}
+}
+
+void
+thread_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, num, avg;
+
+	kprintf("cpu      busy(ms)      idle(ms)  queued    switches"
+		"    syscalls\n");
+	num = cpuarray_num(&allcpus);
+	for (i=0; i<num; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u  %12llu  %12llu  %6u  %10u  %10u\n", c->c_number,
+			c->c_busytime / 1000000, c->c_idletime / 1000000,
+			c->c_runcount,
+			pcpu_counter_readcpu(&thread_switches, c->c_number),
+			pcpu_counter_readcpu(&syscall_count, c->c_number));
+	}
+	kprintf("total switches %u, syscalls %u\n",
+		pcpu_counter_read(&thread_switches),
+		pcpu_counter_read(&syscall_count));
+
+	kprintf("load averages:");
+	for (i=0; i<3; i++) {
+		avg = loadavg[i];
+		kprintf(" %u.%02u", avg >> LOADAVG_SHIFT,
+			((avg & (LOADAVG_SCALE - 1)) * 100) >> LOADAVG_SHIFT);
+	}
+	kprintf("\n");
 }
 
 ////////////////////////////////////////////////////////////
@@ -964,12 +1985,34 @@ thread_consider_migration(void)
  */
 
 /*
- * Create a wait channel. NAME is a symbolic string name for it.
- * This is what's displayed by ps -alx in Unix.
- *
- * NAME should generally be a string constant. If it isn't, alternate
- * arrangements should be made to free it after the wait channel is
- * destroyed.
+ * Set up a wait channel. NAME is a symbolic string name for it.
+ * This is what's displayed by ps -alx in Unix. TABLE is
+ * WCHAN_TURNSTILE for lock waits and WCHAN_SLEEPQ for everything
+ * else.
+ */
+void
+wchan_init(struct wchan *wc, const char *name, unsigned table)
+{
+	KASSERT(table < WCHAN_NTABLES);
+
+	wc->wc_name = name;
+	wc->wc_table = table;
+}
+
+/*
+ * Finish with a wait channel. Nobody may be sleeping on it.
+ */
+void
+wchan_cleanup(struct wchan *wc)
+{
+	KASSERT(wchan_isempty(wc));
+	wc->wc_name = NULL;
+}
+
+/*
+ * Create a wait channel. NAME should generally be a string constant.
+ * If it isn't, alternate arrangements should be made to free it after
+ * the wait channel is destroyed.
  */
 struct wchan *
 wchan_create(const char *name)
@@ -980,37 +2023,34 @@ wchan_create(const char *name)
 	if (wc == NULL) {
 		return NULL;
 	}
-	spinlock_init(&wc->wc_lock);
-	threadlist_init(&wc->wc_threads);
-	wc->wc_name = name;
+	wchan_init(wc, name, WCHAN_SLEEPQ);
 	return wc;
 }
 
 /*
  * Destroy a wait channel. Must be empty and unlocked.
- * (The corresponding cleanup functions require this.)
  */
 void
 wchan_destroy(struct wchan *wc)
 {
-	spinlock_cleanup(&wc->wc_lock);
-	threadlist_cleanup(&wc->wc_threads);
+	wchan_cleanup(wc);
 	kfree(wc);
 }
 
 /*
- * Lock and unlock a wait channel, respectively.
+ * Lock and unlock a wait channel, respectively. This locks the whole
+ * sleep queue it hashes to.
  */
 void
 wchan_lock(struct wchan *wc)
 {
-	spinlock_acquire(&wc->wc_lock);
+	spinlock_acquire(&sleepq_get(wc)->sq_lock);
 }
 
 void
 wchan_unlock(struct wchan *wc)
 {
-	spinlock_release(&wc->wc_lock);
+	spinlock_release(&sleepq_get(wc)->sq_lock);
 }
 
 /*
@@ -1034,16 +2074,20 @@ wchan_sleep(struct wchan *wc)
 void
 wchan_wakeone(struct wchan *wc)
 {
+	struct sleepq *sq = sleepq_get(wc);
 	struct thread *target;
 
-	/* Lock the channel and grab a thread from it */
-	spinlock_acquire(&wc->wc_lock);
-	target = threadlist_remhead(&wc->wc_threads);
+	/* Lock the queue and grab a thread from it */
+	spinlock_acquire(&sq->sq_lock);
+	target = sleepq_first(sq, wc);
+	if (target != NULL) {
+		sleepq_remove(sq, target);
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
 	 */
-	spinlock_release(&wc->wc_lock);
+	spinlock_release(&sq->sq_lock);
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
@@ -1053,39 +2097,61 @@ wchan_wakeone(struct wchan *wc)
 	thread_make_runnable(target, false);
 }
 
+/*
+ * Wake up one particular thread sleeping on a wait channel.
+ */
+void
+wchan_wakethread(struct wchan *wc, struct thread *t)
+{
+	struct sleepq *sq = sleepq_get(wc);
+
+	spinlock_acquire(&sq->sq_lock);
+	KASSERT(t->t_wchan == wc);
+	sleepq_remove(sq, t);
+	spinlock_release(&sq->sq_lock);
+
+	thread_make_runnable(t, false);
+}
+
 /*
  * Wake up all threads sleeping on a wait channel.
  */
 void
 wchan_wakeall(struct wchan *wc)
 {
+	struct sleepq *sq = sleepq_get(wc);
 	struct thread *target;
 	struct threadlist list;
+	uint32_t unidle;
 
 	threadlist_init(&list);
 
 	/*
-	 * Lock the channel and grab all the threads, moving them to a
-	 * private list.
+	 * Lock the queue and grab all the channel's threads, moving
+	 * them to a private list.
 	 */
-	spinlock_acquire(&wc->wc_lock);
-	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+	spinlock_acquire(&sq->sq_lock);
+	while ((target = sleepq_first(sq, wc)) != NULL) {
+		sleepq_remove(sq, target);
 		threadlist_addtail(&list, target);
 	}
 	/*
 	 * Nobody else can wake up these threads now, so we don't need
 	 * to hang onto the lock.
 	 */
-	spinlock_release(&wc->wc_lock);
+	spinlock_release(&sq->sq_lock);
 
 	/*
+	 * Make each thread runnable, collecting the idle cpus that
+	 * need kicking so each gets at most one IPI, sent at the end.
 	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * ops as well, but for now at least don't bother.
 	 */
+	unidle = 0;
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		thread_enqueue(target, false, &unidle);
 	}
+	thread_unidle(unidle);
 
 	threadlist_cleanup(&list);
 }
@@ -1097,15 +2163,103 @@ wchan_wakeall(struct wchan *wc)
 bool
 wchan_isempty(struct wchan *wc)
 {
+	struct sleepq *sq = sleepq_get(wc);
 	bool ret;
 
-	spinlock_acquire(&wc->wc_lock);
-	ret = threadlist_isempty(&wc->wc_threads);
-	spinlock_release(&wc->wc_lock);
+	spinlock_acquire(&sq->sq_lock);
+	ret = sleepq_first(sq, wc) == NULL;
+	spinlock_release(&sq->sq_lock);
 
 	return ret;
 }
 
+/*
+ * Wake one sleeper and requeue the rest. This is for CV broadcast:
+ * everyone woken would just go for the lock, and all but one would
+ * be back asleep on it at once. Putting them straight on the lock's
+ * channel means each lock release wakes the next instead.
+ */
+unsigned
+wchan_wakeone_requeue(struct wchan *wc, struct wchan *target)
+{
+	struct sleepq *sq = sleepq_get(wc);
+	struct sleepq *tsq = sleepq_get(target);
+	struct thread *first, *t;
+	unsigned moved = 0;
+
+	KASSERT(wc->wc_table == WCHAN_SLEEPQ);
+	KASSERT(target->wc_table == WCHAN_TURNSTILE);
+
+	spinlock_acquire(&sq->sq_lock);
+	first = sleepq_first(sq, wc);
+	if (first != NULL) {
+		sleepq_remove(sq, first);
+		t = sleepq_first(sq, wc);
+		if (t != NULL) {
+			spinlock_acquire(&tsq->sq_lock);
+			do {
+				sleepq_remove(sq, t);
+				t->t_wchan_name = target->wc_name;
+				t->t_wchan = target;
+				threadlist_addtail(&tsq->sq_threads, t);
+				moved++;
+			} while ((t = sleepq_first(sq, wc)) != NULL);
+			spinlock_release(&tsq->sq_lock);
+		}
+	}
+	spinlock_release(&sq->sq_lock);
+
+	if (first != NULL) {
+		thread_make_runnable(first, false);
+	}
+	return moved;
+}
+
+/*
+ * Mark the sleepers as blocked on a lock, for priority inheritance.
+ */
+unsigned
+wchan_markblocked(struct wchan *wc, struct lock *blockedon)
+{
+	struct sleepq *sq = sleepq_get(wc);
+	struct thread *t;
+	unsigned n;
+
+	n = 0;
+	spinlock_acquire(&sq->sq_lock);
+	THREADLIST_FORALL(t, sq->sq_threads) {
+		if (t->t_wchan == wc && t->t_blockedon != blockedon) {
+			t->t_blockedon = blockedon;
+			n++;
+		}
+	}
+	spinlock_release(&sq->sq_lock);
+
+	return n;
+}
+
+/*
+ * Best level among the sleepers, for priority inheritance.
+ */
+unsigned
+wchan_toplevel(struct wchan *wc)
+{
+	struct sleepq *sq = sleepq_get(wc);
+	struct thread *t;
+	unsigned level;
+
+	level = RUNQUEUE_LEVELS;
+	spinlock_acquire(&sq->sq_lock);
+	THREADLIST_FORALL(t, sq->sq_threads) {
+		if (t->t_wchan == wc && thread_level(t) < level) {
+			level = thread_level(t);
+		}
+	}
+	spinlock_release(&sq->sq_lock);
+
+	return level;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-cpu work queues and their worker threads.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <percpu.h>
+#include <workqueue.h>
+
+struct workqueue {
+	struct spinlock wq_lock;	/* Protects the list */
+	struct work *wq_head;		/* Queued work, oldest first */
+	struct work **wq_tailp;		/* Where to link the next item */
+	struct wchan wq_wchan;		/* The worker sleeps here */
+};
+
+static PERCPU_DEFINE(struct workqueue, workqueues);
+
+/* Set once the workers exist; until then work runs immediately. */
+static volatile bool workqueue_running;
+
+/* Statistics, for workqueue_printstats. */
+static struct pcpu_counter workqueue_items = PCPU_COUNTER_INITIALIZER;
+static struct pcpu_counter workqueue_batches = PCPU_COUNTER_INITIALIZER;
+
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_pending = 0;
+	w->w_alloced = false;
+}
+
+/*
+ * Run one work item. Clear w_pending first, so that the work can be
+ * queued again (even by itself) while it runs.
+ */
+static
+void
+work_run(struct work *w)
+{
+	void (*func)(void *);
+	void *arg;
+	bool alloced;
+
+	func = w->w_func;
+	arg = w->w_arg;
+	alloced = w->w_alloced;
+	membar_load_any();
+	w->w_pending = 0;
+
+	func(arg);
+
+	if (alloced) {
+		kfree(w);
+	}
+	pcpu_counter_inc(&workqueue_items);
+}
+
+/*
+ * Worker thread for cpu CPUNUM. Moves itself to its cpu, then takes
+ * the whole queue at a time and runs it.
+ */
+static
+void
+workqueue_thread(void *junk, unsigned long cpunum)
+{
+	struct workqueue *wq;
+	struct work *batch, *w;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity(curthread, (uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+
+	wq = &PERCPU_CPU(workqueues, cpunum);
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			/* As in P(): be asleep before workqueue_add wakes us. */
+			wchan_lock(&wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(&wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		batch = wq->wq_head;
+		wq->wq_head = NULL;
+		wq->wq_tailp = &wq->wq_head;
+		spinlock_release(&wq->wq_lock);
+
+		pcpu_counter_inc(&workqueue_batches);
+		while (batch != NULL) {
+			w = batch;
+			batch = w->w_next;
+			work_run(w);
+		}
+	}
+}
+
+/*
+ * Set up the queues and start a worker on each cpu. Called from boot()
+ * once all the cpus are up.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	char name[16];
+	unsigned i, numcpus;
+	int result;
+
+	numcpus = thread_numcpus();
+	for (i=0; i<numcpus; i++) {
+		wq = &PERCPU_CPU(workqueues, i);
+		spinlock_init(&wq->wq_lock);
+		wq->wq_head = NULL;
+		wq->wq_tailp = &wq->wq_head;
+		wchan_init(&wq->wq_wchan, "workqueue", WCHAN_SLEEPQ);
+	}
+	for (i=0; i<numcpus; i++) {
+		snprintf(name, sizeof(name), "worker%u", i);
+		result = thread_fork(name, NULL, workqueue_thread, NULL, i);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+	workqueue_running = true;
+}
+
+void
+workqueue_add(struct work *w)
+{
+	struct workqueue *wq;
+	bool wasempty;
+
+	if (atomic_swap(&w->w_pending, 1) != 0) {
+		/* already queued; it'll get done */
+		return;
+	}
+	if (!workqueue_running) {
+		work_run(w);
+		return;
+	}
+
+	/*
+	 * If we get moved to another cpu after picking the queue, the
+	 * work just runs on the old cpu. That's fine.
+	 */
+	wq = &PERCPU_THIS(workqueues);
+
+	spinlock_acquire(&wq->wq_lock);
+	w->w_next = NULL;
+	wasempty = wq->wq_head == NULL;
+	*wq->wq_tailp = w;
+	wq->wq_tailp = &w->w_next;
+	spinlock_release(&wq->wq_lock);
+
+	/* If the queue wasn't empty the worker is already on its way. */
+	if (wasempty) {
+		wchan_wakeone(&wq->wq_wchan);
+	}
+}
+
+int
+workqueue_schedule(void (*func)(void *), void *arg)
+{
+	struct work *w;
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		return ENOMEM;
+	}
+	work_init(w, func, arg);
+	w->w_alloced = true;
+	workqueue_add(w);
+	return 0;
+}
+
+void
+workqueue_printstats(void)
+{
+	kprintf("workqueue: %u items run in %u batches\n",
+		pcpu_counter_read(&workqueue_items),
+		pcpu_counter_read(&workqueue_batches));
+}
@@ -91,6 +91,9 @@ static struct knowndevarray *knowndevs;
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
+/* Protects knowndevs; see vfs.h. */
+static struct rwlock *vfs_devlock;
+
 
 /*
  * Setup function
@@ -109,6 +112,11 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_devlock = rwlock_create("vfs_devlock");
+	if (vfs_devlock==NULL) {
+		panic("vfs: Could not create vfs device list lock\n");
+	}
+
 	devnull_create();
 }
 
@@ -145,6 +153,34 @@ vfs_biglock_do_i_hold(void)
 	return lock_do_i_hold(vfs_biglock);
 }
 
+/*
+ * Operations on vfs_devlock. Unlike the big lock these are not
+ * recursive.
+ */
+void
+vfs_devlock_acquire_read(void)
+{
+	rwlock_acquire_read(vfs_devlock);
+}
+
+void
+vfs_devlock_release_read(void)
+{
+	rwlock_release_read(vfs_devlock);
+}
+
+void
+vfs_devlock_acquire_write(void)
+{
+	rwlock_acquire_write(vfs_devlock);
+}
+
+void
+vfs_devlock_release_write(void)
+{
+	rwlock_release_write(vfs_devlock);
+}
+
 /*
  * Global sync function - call FSOP_SYNC on all devices.
  */
@@ -154,6 +190,7 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+	vfs_devlock_acquire_read();
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -165,6 +202,7 @@ vfs_sync(void)
 	}
 
 	vfs_biglock_release();
+	vfs_devlock_release_read();
 
 	return 0;
 }
@@ -172,6 +210,8 @@ vfs_sync(void)
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
+ *
+ * The caller must hold vfs_devlock, shared or exclusive.
  */
 int
 vfs_getroot(const char *devname, struct vnode **result)
@@ -179,8 +219,6 @@ vfs_getroot(const char *devname, struct vnode **result)
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -252,6 +290,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
+ *
+ * The caller must hold vfs_devlock, shared or exclusive.
  */
 const char *
 vfs_getdevname(struct fs *fs)
@@ -261,8 +301,6 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -338,7 +376,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold(vfs_devlock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -378,6 +416,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	unsigned index;
 	int result;
 
+	vfs_devlock_acquire_write();
 	vfs_biglock_acquire();
 
 	name = kstrdup(dname);
@@ -413,6 +452,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 
 	if (badnames(name, rawname, volname)) {
 		vfs_biglock_release();
+		vfs_devlock_release_write();
 		return EEXIST;
 	}
 
@@ -424,6 +464,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	vfs_biglock_release();
+	vfs_devlock_release_write();
 	return result;
 
  nomem:
@@ -442,6 +483,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 	
 	vfs_biglock_release();
+	vfs_devlock_release_write();
 	return ENOMEM;
 }
 
@@ -470,7 +512,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_devlock exclusive.
  */
 static
 int
@@ -480,7 +522,7 @@ findmount(const char *devname, struct knowndev **result)
 	unsigned i, num;
 	bool found = false;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold(vfs_devlock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -514,16 +556,19 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
+	vfs_devlock_acquire_write();
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
 	if (result) {
 		vfs_biglock_release();
+		vfs_devlock_release_write();
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
 		vfs_biglock_release();
+		vfs_devlock_release_write();
 		return EBUSY;
 	}
 	KASSERT(kd->kd_rawname != NULL);
@@ -532,6 +577,7 @@ vfs_mount(const char *devname, void *data,
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
 		vfs_biglock_release();
+		vfs_devlock_release_write();
 		return result;
 	}
 
@@ -544,6 +590,7 @@ vfs_mount(const char *devname, void *data,
 		volname ? volname : kd->kd_name, kd->kd_name);
 
 	vfs_biglock_release();
+	vfs_devlock_release_write();
 	return 0;
 }
 
@@ -557,6 +604,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	vfs_devlock_acquire_write();
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -590,6 +638,7 @@ vfs_unmount(const char *devname)
 
  fail:
 	vfs_biglock_release();
+	vfs_devlock_release_write();
 	return result;
 }
 
@@ -603,6 +652,7 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	vfs_devlock_acquire_write();
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -651,6 +701,7 @@ vfs_unmountall(void)
 	}
 
 	vfs_biglock_release();
+	vfs_devlock_release_write();
 
 	return 0;
 }
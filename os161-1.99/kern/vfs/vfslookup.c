@@ -44,6 +44,7 @@ static struct vnode *bootfs_vnode = NULL;
 
 /*
  * Helper function for actually changing bootfs_vnode.
+ * Takes vfs_devlock exclusive, which is what protects bootfs_vnode.
  */
 static
 void
@@ -51,12 +52,16 @@ change_bootfs(struct vnode *newvn)
 {
 	struct vnode *oldvn;
 
+	vfs_devlock_acquire_write();
+
 	oldvn = bootfs_vnode;
 	bootfs_vnode = newvn;
 
 	if (oldvn != NULL) {
 		VOP_DECREF(oldvn);
 	}
+
+	vfs_devlock_release_write();
 }
 
 /*
@@ -75,14 +80,11 @@ vfs_setbootfs(const char *fsname)
 	int result;
 	struct vnode *newguy;
 
-	vfs_biglock_acquire();
-
 	snprintf(tmp, sizeof(tmp)-1, "%s", fsname);
 	s = strchr(tmp, ':');
 	if (s) {
 		/* If there's a colon, it must be at the end */
 		if (strlen(s)>0) {
-			vfs_biglock_release();
 			return EINVAL;
 		}
 	}
@@ -92,19 +94,16 @@ vfs_setbootfs(const char *fsname)
 
 	result = vfs_chdir(tmp);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	result = vfs_getcurdir(&newguy);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	change_bootfs(newguy);
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -114,15 +113,17 @@ vfs_setbootfs(const char *fsname)
 void
 vfs_clearbootfs(void)
 {
-	vfs_biglock_acquire();
 	change_bootfs(NULL);
-	vfs_biglock_release();
 }
 
 
 /*
  * Common code to pull the device name, if any, off the front of a
  * path and choose the vnode to begin the name lookup relative to.
+ *
+ * Called with vfs_devlock held shared. The vnode handed back has a
+ * reference of its own, so the caller can drop the lock before
+ * walking the rest of the path.
  */
 
 static
@@ -133,8 +134,6 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	struct vnode *vn;
 	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
 	 * Locate the first colon or slash.
 	 */
@@ -235,14 +234,18 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
+	vfs_devlock_acquire_read();
 	result = getdevice(path, &path, &startvn);
+	vfs_devlock_release_read();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
+	/*
+	 * The filesystem does its own locking from here on, so
+	 * lookups on different devices (or different cpus, as far as
+	 * the filesystem allows) don't wait for each other.
+	 */
 	if (strlen(path)==0) {
 		/*
 		 * It does not make sense to use just a device name in
@@ -257,7 +260,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 
 	VOP_DECREF(startvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -267,23 +269,20 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
+	vfs_devlock_acquire_read();
 	result = getdevice(path, &path, &startvn);
+	vfs_devlock_release_read();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -77,47 +78,55 @@ vnode_cleanup(struct vnode *vn)
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
+ *
+ * The refcount is updated atomically rather than under the big lock.
+ * Anyone calling this already holds a reference, except the
+ * filesystems' vnode lookups, which hold their own lock against
+ * VOP_RECLAIM.
  */
 void
 vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	vn->vn_refcount++;
-
-	vfs_biglock_release();
+	atomic_inc(&vn->vn_refcount);
 }
 
 /*
  * Decrement refcount.
  * Called by VOP_DECREF.
  * Calls VOP_RECLAIM if the refcount hits zero.
+ *
+ * Any reference but the last is just dropped. The last one is handed
+ * to VOP_RECLAIM still counted: the filesystem rechecks the count
+ * under its own lock, in case a lookup has picked the vnode up again
+ * in the meantime, and either destroys the vnode or drops the
+ * reference and returns EBUSY.
  */
 void
 vnode_decref(struct vnode *vn)
 {
+	uint32_t old, seen;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
+	old = vn->vn_refcount;
+	while (old > 1) {
+		seen = atomic_cas(&vn->vn_refcount, old, old - 1);
+		if (seen == old) {
+			return;
 		}
+		old = seen;
 	}
 
-	vfs_biglock_release();
+	KASSERT(old == 1);
+	result = VOP_RECLAIM(vn);
+	if (result != 0 && result != EBUSY) {
+		// XXX: lame.
+		kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+			strerror(result));
+	}
 }
 
 /*
@@ -202,15 +211,15 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	if (v->vn_refcount < 0) {
+	if (v->vn_refcount >= 0x80000000) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      (int)v->vn_refcount);
 	}
 	else if (v->vn_refcount == 0 && strcmp(opstr, "reclaim")) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
 	else if (v->vn_refcount > 0x100000) {
-		kprintf("vnode_check: vop_%s: warning: large refcount %d\n", 
+		kprintf("vnode_check: vop_%s: warning: large refcount %u\n", 
 			opstr, v->vn_refcount);
 	}
 
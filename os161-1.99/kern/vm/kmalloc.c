@@ -30,12 +30,20 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <percpu.h>
 #include <vm.h>
 
 /*
  * Kernel malloc.
  */
 
+/*
+ * Call counts, for kheap_printstats. These are per-cpu so that
+ * counting doesn't add a shared cache line to every allocation.
+ */
+static struct pcpu_counter kmalloc_calls = PCPU_COUNTER_INITIALIZER;
+static struct pcpu_counter kmalloc_bigcalls = PCPU_COUNTER_INITIALIZER;
+static struct pcpu_counter kfree_calls = PCPU_COUNTER_INITIALIZER;
 
 static
 void
@@ -330,11 +338,25 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Setup; just names the heap lock for the lockstat profile.
+ */
+void
+kheap_bootstrap(void)
+{
+	spinlock_register(&kmalloc_spinlock, "kmalloc");
+}
+
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
 
+	kprintf("kmalloc: %u calls (%u whole-page), kfree: %u calls\n",
+		pcpu_counter_read(&kmalloc_calls),
+		pcpu_counter_read(&kmalloc_bigcalls),
+		pcpu_counter_read(&kfree_calls));
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -601,10 +623,14 @@ subpage_kfree(void *ptr)
 void *
 kmalloc(size_t sz)
 {
+	pcpu_counter_inc(&kmalloc_calls);
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
+		pcpu_counter_inc(&kmalloc_bigcalls);
+
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
@@ -626,7 +652,9 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	pcpu_counter_inc(&kfree_calls);
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
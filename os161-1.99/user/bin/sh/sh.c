@@ -354,6 +354,7 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
+#ifdef HOST
 	pid = fork();
 	switch (pid) {
 		case -1:
@@ -375,6 +376,19 @@ docommand(char *buf)
 		default:
 			break;
 	}
+#else
+	/*
+	 * spawn() builds the child straight from the program, without
+	 * copying our address space just to throw it away in execv.
+	 * If the program can't be run, report it as the child would
+	 * have, with exit status 1.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
+	}
+#endif
 
 	/* parent */
 	if (bg) {
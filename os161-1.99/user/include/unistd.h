@@ -40,6 +40,7 @@
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
+#include <kern/sched.h>
 #include <kern/seek.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
@@ -118,6 +119,8 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args);
 int waitpid(pid_t pid, int *returncode, int flags);
 /* 
  * Open actually takes either two or three args: the optional third
@@ -153,6 +156,12 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int sched_getstats(struct schedstats *stats);
+int sched_setaffinity(pid_t pid, unsigned int mask);
+int sched_getaffinity(pid_t pid, unsigned int *mask);
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int count);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -163,5 +172,6 @@ int __getcwd(char *buf, size_t buflen);
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+/* mutex_lock etc. - see mutex.h (call futex_wait/futex_wake) */
 
 #endif /* _UNISTD_H_ */
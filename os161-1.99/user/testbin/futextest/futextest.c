@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest - test futex_wait/futex_wake and the libc mutex and
+ * condition variable built on them.
+ *
+ * Processes don't share memory, so this can only check the calls
+ * that shouldn't block: a wait on a stale value, a wake with no
+ * waiters, and the uncontended mutex paths, which shouldn't enter
+ * the kernel at all.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <mutex.h>
+
+static volatile int word;
+static struct mutex m;
+static struct cond c;
+
+int
+main(void)
+{
+	int i, result;
+
+	word = 1;
+	result = futex_wait(&word, 0);
+	if (result != -1 || errno != EAGAIN) {
+		errx(1, "futex_wait on a changed value: got %d (errno %d)",
+		     result, errno);
+	}
+
+	result = futex_wake(&word, 1);
+	if (result != 0) {
+		errx(1, "futex_wake with no waiters woke %d", result);
+	}
+
+	result = futex_wait((volatile int *)((char *)&word + 1), 1);
+	if (result != -1 || errno != EINVAL) {
+		errx(1, "futex_wait on a misaligned address: got %d", result);
+	}
+
+	mutex_init(&m);
+	cond_init(&c);
+	for (i = 0; i < 1000; i++) {
+		mutex_lock(&m);
+		if (mutex_trylock(&m) != EAGAIN) {
+			errx(1, "mutex_trylock got a held mutex");
+		}
+		cond_signal(&c);
+		mutex_unlock(&m);
+	}
+	if (m.m_state != 0) {
+		errx(1, "mutex left in state %d", m.m_state);
+	}
+	if (mutex_trylock(&m) != 0) {
+		errx(1, "mutex_trylock failed on a free mutex");
+	}
+	mutex_unlock(&m);
+	cond_broadcast(&c);
+
+	printf("Passed futex test.\n");
+	return 0;
+}
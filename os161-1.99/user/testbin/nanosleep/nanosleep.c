@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * nanosleep - check the nanosleep system call.
+ *
+ * Sleep for a few known intervals and check against __time that we
+ * slept at least that long and not absurdly longer. Then check that a zero-length
+ * sleep returns at once, and that bad requests fail with EINVAL or
+ * EFAULT without sleeping.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+/* Allow this much for getting back on a cpu afterwards. */
+#define LATE_MS		1000
+
+static const struct {
+	time_t secs;
+	long nsecs;
+} intervals[] = {
+	{ 0, 50000000 },	/* 50 ms */
+	{ 0, 250000000 },	/* 250 ms */
+	{ 1, 0 },
+	{ 1, 500000000 },	/* 1.5 s */
+};
+
+#define NINTERVALS (sizeof(intervals) / sizeof(intervals[0]))
+
+/* Milliseconds since some fixed point. */
+static
+long
+now_ms(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (long)secs * 1000 + (long)(nsecs / 1000000);
+}
+
+/* Sleep for SECS and NSECS, which must be valid; return the time taken. */
+static
+long
+timed_sleep(time_t secs, long nsecs)
+{
+	struct timespec req, rem;
+	long start;
+
+	req.tv_sec = secs;
+	req.tv_nsec = nsecs;
+	rem.tv_sec = 1;
+	rem.tv_nsec = 1;
+
+	start = now_ms();
+	if (nanosleep(&req, &rem) < 0) {
+		err(1, "nanosleep %ld.%09ld", (long)secs, nsecs);
+	}
+	if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+		errx(1, "nanosleep %ld.%09ld: remaining time %ld.%09ld, "
+		     "not zero", (long)secs, nsecs,
+		     (long)rem.tv_sec, (long)rem.tv_nsec);
+	}
+	return now_ms() - start;
+}
+
+/* A bad request must fail with ERROR, and return promptly. */
+static
+void
+bad_sleep(const struct timespec *req, int error, const char *desc)
+{
+	long start, elapsed;
+	int result;
+
+	start = now_ms();
+	result = nanosleep(req, NULL);
+	elapsed = now_ms() - start;
+	if (result != -1) {
+		errx(1, "nanosleep with %s: returned %d", desc, result);
+	}
+	if (errno != error) {
+		errx(1, "nanosleep with %s: wrong error %d (expected %d)",
+		     desc, errno, error);
+	}
+	if (elapsed > LATE_MS) {
+		errx(1, "nanosleep with %s: took %ld ms to fail",
+		     desc, elapsed);
+	}
+	printf("nanosleep: %s failed properly\n", desc);
+}
+
+int
+main(void)
+{
+	struct timespec req;
+	long want, elapsed;
+	unsigned i;
+
+	for (i=0; i<NINTERVALS; i++) {
+		want = (long)intervals[i].secs * 1000 +
+			intervals[i].nsecs / 1000000;
+		elapsed = timed_sleep(intervals[i].secs, intervals[i].nsecs);
+		if (elapsed < want) {
+			errx(1, "asked for %ld ms, slept only %ld ms",
+			     want, elapsed);
+		}
+		if (elapsed > want + LATE_MS) {
+			errx(1, "asked for %ld ms, slept %ld ms",
+			     want, elapsed);
+		}
+		printf("nanosleep: asked for %ld ms, slept %ld ms\n",
+		       want, elapsed);
+	}
+
+	elapsed = timed_sleep(0, 0);
+	if (elapsed > LATE_MS) {
+		errx(1, "zero-length sleep took %ld ms", elapsed);
+	}
+	printf("nanosleep: zero-length sleep took %ld ms\n", elapsed);
+
+	req.tv_sec = 0;
+	req.tv_nsec = -1;
+	bad_sleep(&req, EINVAL, "negative tv_nsec");
+
+	req.tv_sec = 0;
+	req.tv_nsec = 1000000000;
+	bad_sleep(&req, EINVAL, "tv_nsec of a whole second");
+
+	req.tv_sec = -1;
+	req.tv_nsec = 0;
+	bad_sleep(&req, EINVAL, "negative tv_sec");
+
+	bad_sleep(NULL, EFAULT, "NULL request");
+
+	printf("nanosleep: passed\n");
+	return 0;
+}
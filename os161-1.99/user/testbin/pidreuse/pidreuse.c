@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pidreuse - check that process IDs are recycled and the process
+ * table grows.
+ *
+ * First fork and reap many more children, one at a time, than there
+ * are PIDs in the first chunk of the process table; every fork must
+ * succeed and the PIDs must get reused. Then keep a lot of children
+ * around unreaped at once, so the table has to grow. Finally leave
+ * some orphans behind: children whose own children outlive them.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define SERIAL	2000	/* children forked and reaped one by one */
+#define WIDE	300	/* children alive at once */
+#define ORPHANS	20	/* children that leave an orphan */
+
+static pid_t pids[WIDE];
+
+static
+pid_t
+dofork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	return pid;
+}
+
+static
+void
+reap(pid_t pid, int code)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid %d", pid);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+		errx(1, "pid %d: bad exit status %d", pid, status);
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid, maxpid;
+	int i, j, status;
+
+	maxpid = 0;
+	for (i=0; i<SERIAL; i++) {
+		pid = dofork();
+		if (pid == 0) {
+			_exit(i % 256);
+		}
+		reap(pid, i % 256);
+		if (pid > maxpid) {
+			maxpid = pid;
+		}
+	}
+	if (maxpid >= SERIAL) {
+		errx(1, "PIDs not reused: %d forks reached pid %d",
+		     SERIAL, maxpid);
+	}
+	printf("pidreuse: %d forks, highest pid %d\n", SERIAL, maxpid);
+
+	/* A reaped child can't be waited for again. */
+	if (waitpid(pid, &status, 0) >= 0 || errno != ESRCH) {
+		errx(1, "waitpid on a reaped child didn't fail with ESRCH");
+	}
+
+	for (i=0; i<WIDE; i++) {
+		pids[i] = dofork();
+		if (pids[i] == 0) {
+			_exit(i % 256);
+		}
+	}
+	for (i=0; i<WIDE; i++) {
+		reap(pids[i], i % 256);
+	}
+	printf("pidreuse: %d children at once\n", WIDE);
+
+	for (i=0; i<ORPHANS; i++) {
+		pid = dofork();
+		if (pid == 0) {
+			if (dofork() == 0) {
+				/* outlive the parent, probably */
+				for (j=0; j<1000; j++) {
+					getpid();
+				}
+				_exit(0);
+			}
+			_exit(1);
+		}
+		reap(pid, 1);
+	}
+	printf("pidreuse: %d orphans left behind\n", ORPHANS);
+
+	printf("pidreuse: passed\n");
+	return 0;
+}
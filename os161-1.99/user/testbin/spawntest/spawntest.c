@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * spawntest - check vfork and spawn.
+ *
+ * The test runs copies of itself: run with "child N" as arguments it
+ * exits with N, so the parent can check the arguments got through.
+ *
+ * vfork: a child that _exits straight away must leave its change to
+ * our memory behind (it borrowed our address space), and a child that
+ * execs must hand its exit code back through waitpid. spawn: a child
+ * must run with the right arguments, and a program that can't be run
+ * must make spawn itself fail, with no child left over.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NSPAWN	20
+
+static volatile int shared;
+
+static
+void
+reap(pid_t pid, int code)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid %d", pid);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+		errx(1, "pid %d: bad exit status %d", pid, status);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char num[16];
+	char *args[4];
+	pid_t pid;
+	int i;
+
+	if (argc == 3 && !strcmp(argv[1], "child")) {
+		_exit(atoi(argv[2]));
+	}
+	if (argc < 1 || argv[0] == NULL) {
+		errx(1, "need argv[0] to find myself");
+	}
+	args[0] = argv[0];
+	args[1] = (char *)"child";
+	args[2] = num;
+	args[3] = NULL;
+
+	/* vfork and _exit: the child ran in our address space */
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		shared = 1;
+		_exit(5);
+	}
+	if (shared != 1) {
+		errx(1, "vfork child didn't share our address space");
+	}
+	reap(pid, 5);
+	printf("spawntest: vfork and _exit ok\n");
+
+	/* vfork and execv */
+	snprintf(num, sizeof(num), "%d", 7);
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv(args[0], args);
+		_exit(99);
+	}
+	reap(pid, 7);
+	printf("spawntest: vfork and execv ok\n");
+
+	/* spawn */
+	for (i=0; i<NSPAWN; i++) {
+		snprintf(num, sizeof(num), "%d", i);
+		pid = spawn(args[0], args);
+		if (pid < 0) {
+			err(1, "spawn %s", args[0]);
+		}
+		reap(pid, i);
+	}
+	printf("spawntest: %d spawns ok\n", NSPAWN);
+
+	/* spawn of something that can't run fails in the parent */
+	pid = spawn("/spawntest-nonexistent", args);
+	if (pid >= 0 || errno != ENOENT) {
+		errx(1, "spawn of a missing program didn't fail with ENOENT");
+	}
+	if (waitpid(-1, NULL, WNOHANG) >= 0 || errno != ECHILD) {
+		errx(1, "failed spawn left a child behind");
+	}
+
+	printf("spawntest: passed\n");
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * waitany - check waitpid with pid -1 and WNOHANG.
+ *
+ * Fork a batch of children that each spin for a different time and
+ * exit with their index, then reap them all with waitpid(-1), in
+ * whatever order they finish; each must turn up exactly once with
+ * the right exit code. Along the way poll with WNOHANG, which must
+ * never block. Finally, with no children left, waitpid(-1) must fail
+ * with ECHILD.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCHILD	32
+
+static pid_t pids[NCHILD];
+static int seen[NCHILD];
+
+static
+int
+findchild(pid_t pid)
+{
+	int i;
+
+	for (i=0; i<NCHILD; i++) {
+		if (pids[i] == pid) {
+			return i;
+		}
+	}
+	errx(1, "waitpid returned %d, which isn't a child", pid);
+	return -1;
+}
+
+static
+void
+check(pid_t pid, int status)
+{
+	int i;
+
+	i = findchild(pid);
+	if (seen[i]) {
+		errx(1, "child %d (pid %d) reaped twice", i, pid);
+	}
+	seen[i] = 1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != i) {
+		errx(1, "child %d (pid %d): bad exit status %d",
+		     i, pid, status);
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid;
+	int i, j, status, polled, reaped;
+
+	for (i=0; i<NCHILD; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			/* later children finish sooner, probably */
+			for (j=0; j<(NCHILD - i) * 200; j++) {
+				getpid();
+			}
+			_exit(i);
+		}
+	}
+
+	/* Poll for a while; whatever has exited gets reaped. */
+	polled = reaped = 0;
+	for (i=0; i<NCHILD; i++) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid < 0) {
+			err(1, "waitpid(-1, WNOHANG)");
+		}
+		polled++;
+		if (pid > 0) {
+			check(pid, status);
+			reaped++;
+		}
+	}
+	printf("waitany: %d polls reaped %d children\n", polled, reaped);
+
+	/* WNOHANG on one child: either still running, or reaped now. */
+	for (i=0; i<NCHILD && seen[i]; i++) {
+		;
+	}
+	if (i < NCHILD) {
+		pid = waitpid(pids[i], &status, WNOHANG);
+		if (pid < 0) {
+			err(1, "waitpid(%d, WNOHANG)", pids[i]);
+		}
+		if (pid > 0) {
+			if (pid != pids[i]) {
+				errx(1, "waitpid(%d, WNOHANG) returned %d",
+				     pids[i], pid);
+			}
+			check(pid, status);
+			reaped++;
+		}
+	}
+
+	while (reaped < NCHILD) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid(-1)");
+		}
+		check(pid, status);
+		reaped++;
+	}
+
+	if (waitpid(-1, &status, 0) >= 0 || errno != ECHILD) {
+		errx(1, "waitpid(-1) with no children didn't fail with ECHILD");
+	}
+	if (waitpid(-1, &status, WNOHANG) >= 0 || errno != ECHILD) {
+		errx(1, "waitpid(-1, WNOHANG) with no children didn't "
+		     "fail with ECHILD");
+	}
+	if (waitpid(-1, &status, 0x100) >= 0 || errno != EINVAL) {
+		errx(1, "waitpid with bad options didn't fail with EINVAL");
+	}
+
+	printf("waitany: passed\n");
+	return 0;
+}
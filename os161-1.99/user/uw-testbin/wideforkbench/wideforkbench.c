@@ -0,0 +1,144 @@
+/*
+ * wideforkbench - concurrent fork/exit/waitpid benchmark built on
+ *  widefork.
+ *
+ *  usage: wideforkbench [nparents [width [rounds]]]
+ *
+ *  the top process forks nparents (default 4) independent parents.
+ *  each parent runs rounds (default 50) of widefork: it forks width
+ *  (default 8) children, which exit at once with unique return codes,
+ *  and then waits for them in birth order, checking each return code.
+ *  the parents have nothing to do with one another, so on a
+ *  multiprocessor their forks, exits and waits should proceed in
+ *  parallel rather than serialise on a global process lock.
+ *
+ *  each parent exits with 0 if all its children's return codes were
+ *  right.  the top process reports the total number of forks and the
+ *  elapsed time.
+ *
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define MAXWIDTH 64
+
+int dofork(int);
+int doround(int);
+void parent(int, int);
+
+int
+dofork(int childnum)
+{
+  pid_t pid;
+  pid = fork();
+  if (pid < 0) {
+    errx(1,"fork %d",childnum);
+  }
+  else if (pid == 0) {
+    /* child */
+    _exit(childnum);
+  }
+  return(pid);
+}
+
+/* one widefork round; returns the number of bad return codes */
+int
+doround(int width)
+{
+  pid_t pids[MAXWIDTH];
+  int i, rval, bad;
+
+  for (i=0; i<width; i++) {
+    pids[i] = dofork(i+1);
+  }
+  bad = 0;
+  for (i=0; i<width; i++) {
+    if (waitpid(pids[i],&rval,0) < 0) {
+      warn("waitpid %d",pids[i]);
+      bad++;
+    }
+    else if (!WIFEXITED(rval) || WEXITSTATUS(rval) != i+1) {
+      bad++;
+    }
+  }
+  return(bad);
+}
+
+void
+parent(int width, int rounds)
+{
+  int i, bad;
+
+  bad = 0;
+  for (i=0; i<rounds; i++) {
+    bad += doround(width);
+  }
+  if (bad > 0) {
+    warnx("pid %d: %d bad return codes",getpid(),bad);
+  }
+  _exit(bad > 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  pid_t pids[MAXWIDTH];
+  int nparents = 4, width = 8, rounds = 50;
+  int i, rval, failed;
+  time_t startsecs, endsecs;
+  unsigned long startnsecs, endnsecs, msecs;
+
+  if (argc > 1) {
+    nparents = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    width = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    rounds = atoi(argv[3]);
+  }
+  if (nparents < 1 || nparents > MAXWIDTH ||
+      width < 1 || width > MAXWIDTH || rounds < 1) {
+    errx(1,"usage: wideforkbench [nparents [width [rounds]]]");
+  }
+
+  __time(&startsecs,&startnsecs);
+  for (i=0; i<nparents; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      errx(1,"fork parent %d",i);
+    }
+    else if (pids[i] == 0) {
+      parent(width,rounds);
+    }
+  }
+  failed = 0;
+  for (i=0; i<nparents; i++) {
+    if (waitpid(pids[i],&rval,0) < 0) {
+      warn("waitpid %d",pids[i]);
+      failed++;
+    }
+    else if (!WIFEXITED(rval) || WEXITSTATUS(rval) != 0) {
+      failed++;
+    }
+  }
+  __time(&endsecs,&endnsecs);
+
+  msecs = (endsecs - startsecs) * 1000;
+  if (endnsecs < startnsecs) {
+    msecs -= 1000;
+    endnsecs += 1000000000;
+  }
+  msecs += (endnsecs - startnsecs) / 1000000;
+
+  printf("%d parents x %d rounds x %d children: %d forks in %lu ms\n",
+	 nparents,rounds,width,nparents*rounds*width,msecs);
+  if (failed > 0) {
+    printf("wideforkbench: %d parents FAILED\n",failed);
+    return(1);
+  }
+  printf("wideforkbench: passed\n");
+  return(0);
+}